@@ -1,5 +1,65 @@
 #include "GaussProcess.h"
 
+//Cn = L*L' in place, L in the lower triangle. Returns false when the
+//matrix is not positive definite
+static bool cholesky(Mat & a)
+{
+	for (int i = 0; i < a.rows; i++)
+	{
+		double * iPtr = a.ptr<double>(i);
+		for (int j = 0; j <= i; j++)
+		{
+			const double * jPtr = a.ptr<double>(j);
+			double sum = iPtr[j];
+			for (int k = 0; k < j; k++)
+				sum -= iPtr[k] * jPtr[k];
+
+			if (j < i)
+				iPtr[j] = sum / jPtr[j];
+			else if (sum > 0.0)
+				iPtr[i] = std::sqrt(sum);
+			else
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//Solves L*L'*X = B in place for the columns [first, last) of b, by a
+//forward and a backward substitution over whole rows
+static void choleskySolve(const Mat & lower, Mat & b, int first, int last)
+{
+	int n = lower.rows;
+	for (int i = 0; i < n; i++)
+	{
+		double * iPtr = b.ptr<double>(i);
+		const double * lPtr = lower.ptr<double>(i);
+		for (int k = 0; k < i; k++)
+		{
+			const double * kPtr = b.ptr<double>(k);
+			for (int c = first; c < last; c++)
+				iPtr[c] -= lPtr[k] * kPtr[c];
+		}
+		for (int c = first; c < last; c++)
+			iPtr[c] /= lPtr[i];
+	}
+
+	for (int i = n - 1; i >= 0; i--)
+	{
+		double * iPtr = b.ptr<double>(i);
+		for (int k = i + 1; k < n; k++)
+		{
+			double lki = lower.at<double>(k, i);
+			const double * kPtr = b.ptr<double>(k);
+			for (int c = first; c < last; c++)
+				iPtr[c] -= lki * kPtr[c];
+		}
+		for (int c = first; c < last; c++)
+			iPtr[c] /= lower.at<double>(i, i);
+	}
+}
+
 void GaussProcess::setParameters(const GaussPars & par)
 {
 	gaussPars = par;
@@ -12,74 +72,308 @@ GaussPars & GaussProcess::getParameters()
 
 void GaussProcess::train()
 {
-	//Using default parameters to calculate matrix Cn
-	updateKernelMatrix();
-	for (int i = 0; i < iters; i++)
+	telemetry.beginTraining();
+	int start = firstIteration();
+	if (optimizer == QUASI_NEWTON)
+		trainQuasiNewton(start);
+	else
+		trainGradientDescent(start);
+	finishTraining();
+	telemetry.endTraining();
+}
+
+void GaussProcess::trainGradientDescent(int start)
+{
+	//Using default parameters to calculate matrix Cn, a resumed run already
+	//has the matrices of the parameters in the checkpoint
+	if (start == 0)
+	{
+		Telemetry::Timer timer(telemetry, Telemetry::KERNEL);
+		updateKernelMatrix();
+	}
+	for (int i = start; i < iters; i++)
 	{
 		//Calculate the gradient of super-parameters
-		calculateParameters();
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::GRADIENT);
+			calculateParameters();
+		}
 
 		//The gradient decent algorithm
-		gaussPars = gaussPars - ratio * deltaPars;
-		updateKernelMatrix();
+		if (kernel)
+		{
+			vector<double> pars = kernel->getParameters();
+			for (size_t j = 0; j < pars.size(); j++)
+				pars[j] -= ratio * deltaLogPars[j];
+			kernel->setParameters(pars);
+		}
+		else
+			gaussPars = gaussPars - ratio * deltaPars;
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::KERNEL);
+			updateKernelMatrix();
+		}
 
 		//Calculate training errors
-		double error = calculateError();
+		double error;
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::EVALUATE);
+			error = calculateError();
+		}
 		errors.push_back(error);
-		if (error - preError >= -threshold &&
-			error - preError <= threshold)
+		telemetry.endIteration(error, dataSet.rows);
+		double change = error - preError;
+		preError = error;
+		if (!continueTraining(i) ||
+			(change >= -threshold && change <= threshold))
 			break;
 	}
 }
 
-GaussDist GaussProcess::predict(Mat & dataPoints)
+//L-BFGS on the log parameters of the kernel, minimizing the negative
+//log-likelihood. An evaluation factorizes Cn once for both the loss and
+//the gradient. A trial step whose Cn is not positive definite costs +inf,
+//so the line search shortens it; only the starting point must be valid.
+//A resumed run starts a new search from the parameters of the checkpoint
+void GaussProcess::trainQuasiNewton(int start)
 {
-	double mean = 0.0;
-	double sigma = 0.0;
+	if (!kernel)
+		throw std::exception("The quasi-Newton optimizer needs a kernel!");
+
+	vector<double> pars = kernel->getParameters();
+	vector<double> accepted = pars;
+	bool started = false;
+	auto objective = [&](const vector<double> & x, vector<double> & g)
+	{
+		kernel->setParameters(x);
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::KERNEL);
+			try
+			{
+				updateKernelMatrix();
+			}
+			catch (const std::exception &)
+			{
+				if (!started)
+					throw;
+				return std::numeric_limits<double>::infinity();
+			}
+		}
+		started = true;
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::GRADIENT);
+			calculateParameters();
+		}
+		g = deltaLogPars;
+
+		Telemetry::Timer timer(telemetry, Telemetry::EVALUATE);
+		return -calculateError();
+	};
+
+	//The last evaluation of the line search may be a rejected step
+	auto moveTo = [&](const vector<double> & x)
+	{
+		if (x != kernel->getParameters())
+		{
+			kernel->setParameters(x);
+			updateKernelMatrix();
+		}
+	};
 
-	//Calculate k matrix of Gauss Process
-	Mat k = Mat::zeros(1, dataSet.cols, CV_64FC1);
-	double * kPtr = k.ptr<double>(0);
-	for (int i = 0; i < dataSet.cols; i++)
+	auto progress = [&](int i, const vector<double> & x, double fx)
 	{
-		*kPtr = calculateKernel(dataPoints, dataSet.row(i));
-		kPtr++;
+		moveTo(x);
+		accepted = x;
+		errors.push_back(-fx);
+		telemetry.endIteration(-fx, dataSet.rows);
+		preError = -fx;
+		return continueTraining(start + i);
+	};
+
+	LBFGS search(memory, std::max(iters - start, 1), threshold);
+	try
+	{
+		search.minimize(objective, pars, progress);
+	}
+	catch (...)
+	{
+		//Leaving the model at the last accepted point, not at a trial step
+		if (started)
+			moveTo(accepted);
+		throw;
 	}
+	moveTo(pars);
+}
 
-	Mat tmp = k * CnInv;
-	dist.mean = tmp.dot(dataPoints);
-	dist.sigma = calculateKernel(dataPoints, dataPoints) - tmp.dot(k);
+GaussDist GaussProcess::predict(Mat & dataPoints)
+{
+	Mat means, sigmas;
+	predictBatch(dataPoints, means, sigmas);
+	dist.mean = means.at<double>(0, 0);
+	dist.sigma = sigmas.at<double>(0, 0);
 
 	return dist;
 }
 
-void GaussProcess::updateKernelMatrix()
+void GaussProcess::predictBatch(const Mat & points, Mat & means, Mat & sigmas) const
+{
+	Mat k = crossKernel(points);
+	Mat kInv;
+	cv::gemm(k, weights, 1.0, cv::noArray(), 0.0, means);
+	cv::gemm(k, CnInv, 1.0, cv::noArray(), 0.0, kInv);
+
+	Mat self;
+	if (kernel)
+		kernel->diagonal(points, self);
+	sigmas.create(points.rows, 1, CV_64FC1);
+	executor->parallelFor(0, points.rows, [&](int first, int last)
+	{
+		for (int p = first; p < last; p++)
+		{
+			double prior = kernel ? self.at<double>(p, 0) :
+				calculateKernel(points.row(p), points.row(p));
+			sigmas.at<double>(p, 0) = prior - kInv.row(p).dot(k.row(p));
+		}
+	}, 256);
+}
+
+//The checkpoint holds the hyper-parameters, the kernel matrices are rebuilt
+void GaussProcess::saveState(cv::FileStorage & fs) const
+{
+	fs << "alpha" << gaussPars.alpha;
+	fs << "beta" << gaussPars.beta;
+	fs << "theta0" << gaussPars.theta0;
+	fs << "theta1" << gaussPars.theta1;
+	fs << "theta2" << gaussPars.theta2;
+	fs << "theta3" << gaussPars.theta3;
+	if (kernel)
+		fs << "kernel" << kernel->getParameters();
+	fs << "preError" << preError;
+	fs << "errors" << errors;
+}
+
+void GaussProcess::loadState(const cv::FileNode & node)
+{
+	node["alpha"] >> gaussPars.alpha;
+	node["beta"] >> gaussPars.beta;
+	node["theta0"] >> gaussPars.theta0;
+	node["theta1"] >> gaussPars.theta1;
+	node["theta2"] >> gaussPars.theta2;
+	node["theta3"] >> gaussPars.theta3;
+	if (kernel)
+	{
+		vector<double> pars;
+		node["kernel"] >> pars;
+		kernel->setParameters(pars);
+	}
+	node["preError"] >> preError;
+	node["errors"] >> errors;
+	updateKernelMatrix();
+}
+
+//Mean squared error of the predictive means over all the outputs
+double GaussProcess::validationLoss(const Mat & data, const Mat & targets) const
+{
+	if (targets.rows != data.rows || targets.cols != Tn.cols)
+		throw std::exception("Invalid validation set!");
+
+	Mat means;
+	cv::gemm(crossKernel(data), weights, 1.0, cv::noArray(), 0.0, means);
+	double loss = cv::norm(means, targets, cv::NORM_L2SQR);
+
+	return loss / (data.rows * Tn.cols);
+}
+
+//P*N kernel matrix between the points and the training samples
+Mat GaussProcess::crossKernel(const Mat & points) const
 {
-	for (int i = 0; i < Cn.rows; i++)
+	Mat k(points.rows, dataSet.rows, CV_64FC1);
+	if (kernel)
+	{
+		kernel->gram(points, dataSet, k);
+		return k;
+	}
+
+	executor->parallelFor(0, points.rows, [&](int first, int last)
 	{
-		double * rowPtr = Cn.ptr<double>(i);
-		double * theta0Ptr = Theta0.ptr<double>(i);
-		double * theta1Ptr = Theta1.ptr<double>(i);
-		double * theta3Ptr = Theta3.ptr<double>(i);
-		for (int j = 0; j < Cn.cols; j++)
+		for (int p = first; p < last; p++)
 		{
-			*rowPtr++ = calculateKernel(dataSet.row(i), dataSet.row(j));
-			*theta0Ptr++ = calculateTheta0(dataSet.row(i), dataSet.row(j));
-			*theta1Ptr++ = calculateTheta1(dataSet.row(i), dataSet.row(j));
-			*theta3Ptr++ = dataSet.row(i).dot(dataSet.row(j));
+			double * kPtr = k.ptr<double>(p);
+			for (int i = 0; i < dataSet.rows; i++)
+				kPtr[i] = calculateKernel(points.row(p), dataSet.row(i));
 		}
+	}, 16);
+
+	return k;
+}
+
+//The rows of the built-in kernel matrix are independent, so they are filled
+//in parallel. A kernel of the library fills Cn and its derivatives in blocks
+void GaussProcess::updateKernelMatrix()
+{
+	if (kernel)
+	{
+		kernelGrads.clear();
+		kernel->gram(dataSet, Cn, &kernelGrads);
+	}
+	else
+	{
+		executor->parallelFor(0, Cn.rows, [&](int first, int last)
+		{
+			for (int i = first; i < last; i++)
+			{
+				double * rowPtr = Cn.ptr<double>(i);
+				double * theta0Ptr = Theta0.ptr<double>(i);
+				double * theta1Ptr = Theta1.ptr<double>(i);
+				double * theta3Ptr = Theta3.ptr<double>(i);
+				for (int j = 0; j < Cn.cols; j++)
+				{
+					*rowPtr++ = calculateKernel(dataSet.row(i), dataSet.row(j));
+					*theta0Ptr++ = calculateTheta0(dataSet.row(i), dataSet.row(j));
+					*theta1Ptr++ = calculateTheta1(dataSet.row(i), dataSet.row(j));
+					*theta3Ptr++ = dataSet.row(i).dot(dataSet.row(j));
+				}
+			}
+		}, 16);
+	}
+
+	//One Cholesky factorization Cn = L*L' serves all the outputs, the loss
+	//and the gradient: ln|Cn| = 2*sum(ln Lii), and the right-hand sides
+	//[I | Tn] are solved together for Cn^-1 and Cn^-1 * Tn. A jitter growing
+	//from 1e-10 of the mean diagonal rescues nearly singular matrices
+	Mat lower = Cn.clone();
+	double scale = std::max(std::abs(cv::trace(Cn).val[0]) / Cn.rows, 1e-300);
+	for (double jitter = 1e-10; !cholesky(lower); jitter *= 10.0)
+	{
+		if (jitter > 1e-4)
+			throw std::exception("The kernel matrix is not positive definite!");
+		lower = Cn + jitter * scale * Mat::eye(Cn.rows, Cn.cols, CV_64FC1);
 	}
 
-	CnInv = Cn.inv();
+	logDetCn = 0.0;
+	for (int i = 0; i < lower.rows; i++)
+		logDetCn += 2.0 * std::log(lower.at<double>(i, i));
+
+	Mat rhs = Mat::zeros(Cn.rows, Cn.cols + Tn.cols, CV_64FC1);
+	Mat eye = rhs.colRange(0, Cn.cols);
+	cv::setIdentity(eye);
+	Mat targets = rhs.colRange(Cn.cols, rhs.cols);
+	Tn.copyTo(targets);
+	executor->parallelFor(0, rhs.cols, [&](int first, int last)
+	{
+		choleskySolve(lower, rhs, first, last);
+	}, 64);
+
+	CnInv = rhs.colRange(0, Cn.cols).clone();
+	weights = rhs.colRange(Cn.cols, rhs.cols).clone();
 }
 
-double GaussProcess::calculateKernel(Mat & dot1, Mat & dot2)
+double GaussProcess::calculateKernel(const Mat & dot1, const Mat & dot2) const
 {
 	if (dot1.size != dot2.size)
 		throw std::exception("Two vectors must have same number of elements!");
 
-	Mat diff = dot1 - dot2;
-	double mul1 = diff.dot(diff);
+	double mul1 = cv::norm(dot1, dot2, cv::NORM_L2SQR);
 	double mul2 = dot1.dot(dot2);
 	double exp = std::exp(-0.5 * gaussPars.theta1 * mul1);
 	double rst = gaussPars.theta0*exp + gaussPars.theta2 + gaussPars.theta3*mul2;
@@ -87,65 +381,80 @@ double GaussProcess::calculateKernel(Mat & dot1, Mat & dot2)
 	return rst;
 }
 
-double GaussProcess::calculateTheta0(Mat & dot1, Mat & dot2)
+double GaussProcess::calculateTheta0(const Mat & dot1, const Mat & dot2) const
 {
 	if (dot1.size != dot2.size)
 		throw std::exception("Two vectors must have same number of elements!");
 
-	Mat diff = dot1 - dot2;
-	double tmp = diff.dot(diff);
+	double tmp = cv::norm(dot1, dot2, cv::NORM_L2SQR);
 	double e = -0.5*gaussPars.theta1*tmp;
 
 	return std::exp(e);
 }
 
-double GaussProcess::calculateTheta1(Mat & dot1, Mat & dot2)
+double GaussProcess::calculateTheta1(const Mat & dot1, const Mat & dot2) const
 {
 	if (dot1.size != dot2.size)
 		throw std::exception("Two vectors must have same number of elements!");
 
-	Mat diff = dot1 - dot2;
-	double tmp = diff.dot(diff);
+	double tmp = cv::norm(dot1, dot2, cv::NORM_L2SQR);
 	double par = -0.5 * gaussPars.theta0 * tmp;
 	double e = -0.5 * gaussPars.theta1 * tmp;
 
 	return par * std::exp(e);
 }
 
+//All the derivative matrices are symmetric, so tr(Cn^-1 * m) is the
+//element-wise dot product of Cn^-1 and m, and Tn' * Cn^-1 is the transpose
+//of w = Cn^-1 * Tn. The derivatives of the constant and diagonal terms
+//have closed forms, so no N*N temporary is built. The outputs share Cn,
+//so the trace terms count once per output
 void GaussProcess::calculateParameters()
 {
-	Mat tmpM = -1.0 / gaussPars.alpha * Cn;
-	deltaPars.alpha = calculateParameters(tmpM);
-	tmpM = -1.0 / gaussPars.beta * Mat::ones(Cn.rows, Cn.cols, CV_64FC1);
-	deltaPars.beta = calculateParameters(tmpM);
-	deltaPars.theta0 = calculateParameters(Theta0);
-	deltaPars.theta1 = calculateParameters(Theta1);
-	tmpM = Mat::eye(Cn.rows, Cn.cols, CV_64FC1);
-	deltaPars.theta2 = calculateParameters(tmpM);
-	deltaPars.theta3 = calculateParameters(Theta3);
+	Scratch::Frame frame;
+	Mat mw = frame.take(Cn.rows, Tn.cols);
+	const Mat & w = weights;
+	double outputs = Tn.cols;
+	if (kernel)
+	{
+		deltaLogPars.resize(kernelGrads.size());
+		for (size_t j = 0; j < kernelGrads.size(); j++)
+			deltaLogPars[j] = calculateParameters(kernelGrads[j], w, mw);
+		return;
+	}
+
+	deltaPars.alpha = -1.0 / gaussPars.alpha * calculateParameters(Cn, w, mw);
+	Mat sumW;
+	cv::reduce(w, sumW, 0, cv::REDUCE_SUM);
+	double partBeta = 0.5 * outputs * cv::sum(CnInv).val[0] - 0.5 * sumW.dot(sumW);
+	deltaPars.beta = -1.0 / gaussPars.beta * partBeta;
+	deltaPars.theta0 = calculateParameters(Theta0, w, mw);
+	deltaPars.theta1 = calculateParameters(Theta1, w, mw);
+	deltaPars.theta2 = 0.5 * outputs * cv::trace(CnInv).val[0] - 0.5 * w.dot(w);
+	deltaPars.theta3 = calculateParameters(Theta3, w, mw);
 }
 
-double GaussProcess::calculateParameters(Mat & m)
+double GaussProcess::calculateParameters(const Mat & m, const Mat & w, Mat & mw) const
 {
 	if (m.size != CnInv.size)
 		throw std::exception("Two vectors must have same size!");
 
-	auto scaler = cv::trace(CnInv * m);
-	double part1 = scaler.val[0] * 0.5;
-	Mat dot = Tn.t() * CnInv;
-	Mat tmp = dot * m;
-	double part2 = tmp.dot(dot.t()) * -0.5;
+	double part1 = CnInv.dot(m) * 0.5 * w.cols;
+	cv::gemm(m, w, 1.0, cv::noArray(), 0.0, mw);
+	double part2 = w.dot(mw) * -0.5;
 
 	return part1 + part2;
 }
 
 
+//Log-likelihood summed over the outputs,
+//-M/2 ln|Cn| - 1/2 sum(tm' Cn^-1 tm) - M*N/2 ln(2pi)
 double GaussProcess::calculateError()
 {
-	double det = cv::determinant(CnInv);
-	double part1 = -0.5 * std::log(det);
-	double part2 = -0.5 * dataSet.cols * std::log(2 * 3.1415);
-	double part3 = -0.5 * (Tn.t() * CnInv).dot(Tn);
+	double outputs = Tn.cols;
+	double part1 = -0.5 * outputs * logDetCn;
+	double part2 = -0.5 * outputs * dataSet.rows * std::log(2 * 3.1415);
+	double part3 = -0.5 * weights.dot(Tn);
 
 	return part1 + part2 + part3;
 }
@@ -4,8 +4,12 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <limits>
 
 #include "mlbase.h"
+#include "scratch.h"
+#include "kernels.h"
+#include "lbfgs.h"
 
 using std::endl;
 using std::cout;
@@ -46,22 +50,26 @@ struct GaussDist
 class GaussProcess : public MLBase
 {
 public:
+	enum OptimizerType { PLAIN, QUASI_NEWTON };
+
+	//t is N*M with one column per output, the outputs share the kernel
 	GaussProcess(Mat & t, Mat & datas, double r = 0.1, int i = 100) 
 	try:
 		ratio(r), iters(i)
 	{
-		if (t.rows != datas.rows)
+		if (t.rows != datas.rows || t.cols < 1)
 			throw std::exception("Invalid input data!");
 
 		preError = 0.0;
 		threshold = 0.0001;
 
+		//Every row of datas is a sample, the kernel matrix is N*N
 		Tn = t;
-		dataSet = datas; 3 * Cn;
-		Cn = Mat::zeros(cv::Size(datas.cols, datas.cols), CV_64FC1);
-		Theta0 = Mat::zeros(cv::Size(datas.cols, datas.cols), CV_64FC1);
-		Theta1 = Mat::zeros(cv::Size(datas.cols, datas.cols), CV_64FC1);
-		Theta3 = Mat::zeros(cv::Size(datas.cols, datas.cols), CV_64FC1);
+		dataSet = datas;
+		Cn = Mat::zeros(cv::Size(datas.rows, datas.rows), CV_64FC1);
+		Theta0 = Mat::zeros(cv::Size(datas.rows, datas.rows), CV_64FC1);
+		Theta1 = Mat::zeros(cv::Size(datas.rows, datas.rows), CV_64FC1);
+		Theta3 = Mat::zeros(cv::Size(datas.rows, datas.rows), CV_64FC1);
 	}
 	catch (const std::exception& e)
 	{
@@ -70,16 +78,40 @@ public:
 
 	void setParameters(const GaussPars & par);
 	GaussPars & getParameters();
+	//Replaces the built-in kernel by a copy of k, the training then moves the
+	//log parameters of the kernel instead of the GaussPars
+	void setKernel(const KernelPtr & k)
+	{
+		kernel = k ? k->clone() : KernelPtr();
+	}
+	KernelPtr getKernel() const { return kernel; }
+	//PLAIN is the gradient descent with the learning ratio. QUASI_NEWTON runs
+	//L-BFGS with m remembered steps on the log parameters of the kernel set
+	//by setKernel, with far fewer factorizations of Cn
+	void setOptimizer(OptimizerType o, int m = 10)
+	{
+		optimizer = o;
+		if (m >= 1)
+			memory = m;
+	}
 	void train() override;
+	//The mean is the one of the first output
 	GaussDist predict(Mat & dataPoints);
+	//points is P*D, means is P*M with all the outputs and sigmas is P*1,
+	//the variance does not depend on the output
+	void predictBatch(const Mat & points, Mat & means, Mat & sigmas) const;
+	int numOfOutputs() const { return Tn.cols; }
 	vector<double> & showErrors() override { return errors; }
 	const vector<double> & showErrors() const override { return errors; }
+	vector<double> & showLossFuncVals() override { return errors; }
+	const vector<double> & showLossFuncVals() const override { return errors; }
 
 private:
 	//Transit matrixs
 	Mat Tn;
 	Mat Cn;
 	Mat CnInv;
+	Mat weights;
 	Mat Theta0;
 	Mat Theta1;
 	Mat Theta3;
@@ -88,19 +120,31 @@ private:
 	//Super parameters of Gauss Process
 	GaussPars gaussPars;
 	GaussPars deltaPars;
+	KernelPtr kernel;
+	vector<Mat> kernelGrads;
+	vector<double> deltaLogPars;
 	GaussDist dist;
 	double ratio;
 	double threshold;
 	double preError;
+	double logDetCn;
 	int iters;
+	OptimizerType optimizer = PLAIN;
+	int memory = 10;
 	vector<double> errors;
 
 	//Private calculation functions
+	void trainGradientDescent(int start);
+	void trainQuasiNewton(int start);
+	void saveState(cv::FileStorage & fs) const override;
+	void loadState(const cv::FileNode & node) override;
+	double validationLoss(const Mat & data, const Mat & targets) const override;
 	void updateKernelMatrix();
-	double calculateKernel(Mat & dot1, Mat & dot2);
-	double calculateTheta0(Mat & dot1, Mat & dot2);
-	double calculateTheta1(Mat & dot1, Mat & dots);
+	Mat crossKernel(const Mat & points) const;
+	double calculateKernel(const Mat & dot1, const Mat & dot2) const;
+	double calculateTheta0(const Mat & dot1, const Mat & dot2) const;
+	double calculateTheta1(const Mat & dot1, const Mat & dot2) const;
 	void calculateParameters();
-	double calculateParameters(Mat & m);
+	double calculateParameters(const Mat & m, const Mat & w, Mat & mw) const;
 	double calculateError();
 };
@@ -17,8 +17,8 @@ try : ratio(0.01), lambda1(0.5), lambda2(0.5),
 	numOfOutput = l.cols;
 	hiddenPars = Mat::zeros(cv::Size(numOfInput, numOfHidden), CV_64FC1);
 	deltaHiddenPars = Mat::zeros(cv::Size(numOfInput, numOfHidden), CV_64FC1);
-	outputPars = Mat::zeros(cv::Size(numOfHidden + 1, numOfInput), CV_64FC1);
-	deltaOutputPars = Mat::zeros(cv::Size(numOfHidden + 1, numOfInput), CV_64FC1);
+	outputPars = Mat::zeros(cv::Size(numOfHidden + 1, numOfOutput), CV_64FC1);
+	deltaOutputPars = Mat::zeros(cv::Size(numOfHidden + 1, numOfOutput), CV_64FC1);
 
 	//ʼ
 	double lowRange = -1 / (std::sqrt(numOfInput));
@@ -41,7 +41,7 @@ void ANN::initParameters(double lowRange, double highRange)
 {
 	//ʼ
 	std::default_random_engine e;
-	std::uniform_int_distribution<double> u(lowRange, highRange);
+	std::uniform_real_distribution<double> u(lowRange, highRange);
 
 	//ʼ
 	int rows = hiddenPars.rows;
@@ -72,38 +72,52 @@ void ANN::initParameters(double lowRange, double highRange)
 
 void ANN::train()
 {
-	for (int i = 0; i < dataSet.rows; i++)
+	//ÿһβӼָʱһ
+	telemetry.beginTraining();
+	for (int i = firstIteration(); i < dataSet.rows; i++)
 	{
-		calculateLayerOutputs(i);
-
-		switch (func)
 		{
-		case ANN::SIGMOID:
-			outputDiff = sigmoidOutput - labels.row(i);
-			break;
-		case ANN::LINEAR:
-			outputDiff = output - labels.row(i);
-			break;
-		case ANN::SOFTMAX:
-			outputDiff = softmaxOutput - labels.row(i);
-			break;
-		default:
-			break;
+			Telemetry::Timer timer(telemetry, Telemetry::FORWARD);
+			calculateLayerOutputs(i);
+
+			switch (func)
+			{
+			case ANN::SIGMOID:
+				outputDiff = sigmoidOutput - labels.row(i);
+				break;
+			case ANN::LINEAR:
+				outputDiff = output - labels.row(i);
+				break;
+			case ANN::SOFTMAX:
+				outputDiff = softmaxOutput - labels.row(i);
+				break;
+			default:
+				break;
+			}
+		}
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::BACKWARD);
+			calculateParameters(i);
+
+			//ݶ½㷨ΪL2
+			hiddenPars = hiddenPars -
+				ratio * (deltaHiddenPars + lambda1 * deltaHiddenPars);
+			outputPars = outputPars - 
+				ratio * (deltaOutputPars + lambda2 * deltaOutputPars);
 		}
 
-		calculateParameters(i);
-
-		//ݶ½㷨ΪL2
-		hiddenPars = hiddenPars -
-			ratio * (deltaHiddenPars + lambda1 * deltaHiddenPars);
-		outputPars = outputPars - 
-			ratio * (deltaOutputPars + lambda2 * deltaOutputPars);
-
-		double error = errorCalculate(func);
+		double error;
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::EVALUATE);
+			error = errorCalculate(dataSet, labels, func);
+		}
 		errors.push_back(error);
-		if (error <= threshold)
+		telemetry.endIteration(error, 1);
+		if (!continueTraining(i) || error <= threshold)
 			break;
 	}
+	finishTraining();
+	telemetry.endTraining();
 }
 
 vector<double> ANN::predict(Mat & data)
@@ -129,6 +143,37 @@ vector<double> ANN::predict(Mat & data)
 	return rst;
 }
 
+//㱣Ĳѧϰʺʷ
+void ANN::saveState(cv::FileStorage & fs) const
+{
+	fs << "hiddenPars" << hiddenPars;
+	fs << "outputPars" << outputPars;
+	fs << "ratio" << ratio;
+	fs << "errors" << errors;
+}
+
+void ANN::loadState(const cv::FileNode & node)
+{
+	Mat hidden, out;
+	node["hiddenPars"] >> hidden;
+	node["outputPars"] >> out;
+	if (hidden.size != hiddenPars.size || out.size != outputPars.size)
+		throw std::exception("The checkpoint does not match the model!");
+
+	hiddenPars = hidden;
+	outputPars = out;
+	node["ratio"] >> ratio;
+	node["errors"] >> errors;
+}
+
+double ANN::validationLoss(const Mat & data, const Mat & targets) const
+{
+	if (targets.cols != numOfOutput)
+		throw std::exception("Invalid validation set!");
+
+	return errorCalculate(data, targets, func);
+}
+
 void ANN::calculateParameters(int index)
 {
 	//Calculating differeciation of output layer's parameters
@@ -166,165 +211,127 @@ void ANN::calculateParameters(int index)
 
 			double Xi = dataSet.row(index).at<double>(i);
 			double Wji = Xi * Zj * sum;
-			deltaHiddenPars.at<double>(j, i) = Wji;
+			deltaHiddenPars.at<double>(j - 1, i) = Wji;
 		}
 	}
 }
 
 void ANN::calculateLayerOutputs(int index)
 {
-	//Calculating hidden layer's outputs
-	hiddenOutput.at<double>(0, 0) = 1.0;
-	for (int i = 1; i < hiddenOutput.cols; i++)
-	{
-		double hidden = 
-			calculateHidden(dataSet.row(index), hiddenPars.row(i));
-		hiddenOutput.at<double>(0, i) = hidden;
-	}
-
-	//Calculating output layer
-	for (int i = 0; i < output.cols; i++)
-	{
-		double rst = output.row(i).dot(hiddenOutput);
-		output.at<double>(0, i) = rst;
-	}
+	calculateLayerOutputs(dataSet.row(index));
+}
 
-	//Calculating softmax or sigmoid
-	switch (func)
-	{
-	case ANN::SIGMOID:
-		calculateSigmoid(output);
-		break;
-	case ANN::SOFTMAX:
-		calculateSoftmax(output);
-		break;
-	default:
-		break;
-	}
+void ANN::calculateLayerOutputs(const Mat & data)
+{
+	Mat & activated = func == SOFTMAX ? softmaxOutput : sigmoidOutput;
+	forward(data, hiddenOutput, output, activated);
 }
 
-void ANN::calculateLayerOutputs(Mat & data)
+//ǰֻдṩĻ˿ڶ߳ͬʱ
+void ANN::forward(const Mat & data, Mat & hidden, Mat & linear, Mat & activated) const
 {
-	//Calculating hidden layer's outputs
-	hiddenOutput.at<double>(0, 0) = 1.0;
-	for (int i = 1; i < hiddenOutput.cols; i++)
-	{
-		double hidden =
-			calculateHidden(data, hiddenPars.row(i));
-		hiddenOutput.at<double>(0, i) = hidden;
-	}
+	//Calculating hidden layer's outputs, the first one is the bias
+	hidden.at<double>(0, 0) = 1.0;
+	for (int i = 1; i < hidden.cols; i++)
+		hidden.at<double>(0, i) = calculateHidden(data, hiddenPars.row(i - 1));
 
 	//Calculating output layer
-	for (int i = 0; i < output.cols; i++)
-	{
-		double rst = output.row(i).dot(hiddenOutput);
-		output.at<double>(0, i) = rst;
-	}
+	for (int i = 0; i < linear.cols; i++)
+		linear.at<double>(0, i) = outputPars.row(i).dot(hidden);
 
 	//Calculating softmax or sigmoid
 	switch (func)
 	{
 	case ANN::SIGMOID:
-		calculateSigmoid(output);
-		break;
-	case ANN::SOFTMAX:
-		calculateSoftmax(output);
-		break;
-	default:
-		break;
-	}
-}
-
-double ANN::errorCalculate(ActFunc func)
-{
-	double error = 0.0;
-	switch (func)
-	{
-	case ANN::SIGMOID:
-		error = sigmoidError();
-		break;
-	case ANN::LINEAR:
-		error = squareError();
+		calculateSigmoid(linear, activated);
 		break;
 	case ANN::SOFTMAX:
-		error = softmaxError();
+		calculateSoftmax(linear, activated);
 		break;
 	default:
+		linear.copyTo(activated);
 		break;
 	}
-	
-	return error;
 }
 
-double ANN::squareError()
+//ֿ鲢м㣬ĲֺͰ˳ۼ
+double ANN::errorCalculate(const Mat & data, const Mat & targets, ActFunc func) const
 {
-	double sumAll = 0.0;
-	for (int i = 0; i < dataSet.rows; i++)
+	auto partialError = [&](int first, int last)
 	{
-		calculateLayerOutputs(i);
+		Mat hidden(1, numOfHidden + 1, CV_64FC1);
+		Mat linear(1, numOfOutput, CV_64FC1);
+		Mat activated(1, numOfOutput, CV_64FC1);
 
-		outputDiff = output - labels.row(i);
 		double sum = 0.0;
-		for (int k = 0; k < outputDiff.cols; k++)
+		for (int i = first; i < last; i++)
 		{
-			double tmp = outputDiff.at<double>(0, k);
-			sum += tmp * tmp;
+			forward(data.row(i), hidden, linear, activated);
+			switch (func)
+			{
+			case ANN::SIGMOID:
+				sum += sigmoidError(activated, targets.row(i));
+				break;
+			case ANN::LINEAR:
+				sum += squareError(activated, targets.row(i));
+				break;
+			case ANN::SOFTMAX:
+				sum += softmaxError(activated, targets.row(i));
+				break;
+			default:
+				break;
+			}
 		}
-		sum /= dataSet.rows;
 
-		sumAll += sum;
-	}
+		return sum;
+	};
 
-	return sumAll;
+	double error = executor->parallelReduce(0, data.rows, 0.0,
+		partialError, std::plus<double>(), 64);
+	
+	return error / data.rows;
 }
 
-double ANN::sigmoidError()
+double ANN::squareError(const Mat & out, const Mat & label) const
 {
-	double sumAll = 0.0;
-	for (int i = 0; i < dataSet.rows; i++)
+	double sum = 0.0;
+	for (int k = 0; k < out.cols; k++)
 	{
-		calculateLayerOutputs(i);
-
-		double sum = 0.0;
-		for (int k = 0; k < sigmoidOutput.cols; k++)
-		{
-			double Yk = softmaxOutput.at<double>(0, k);
-			double Tk = labels.row(i).at<double>(0, k);
-			sum += Tk*std::log(Yk) + (1 - Tk)*std::log(1 - Yk);
-		}
-		sum /= dataSet.rows;
-
-		sumAll += sum;
+		double tmp = out.at<double>(0, k) - label.at<double>(0, k);
+		sum += tmp * tmp;
 	}
 
-	return sumAll;
+	return sum;
 }
 
-double ANN::softmaxError()
+//ȡţʹԽСԽ
+double ANN::sigmoidError(const Mat & out, const Mat & label) const
 {
-	double sumAll = 0.0;
-	for (int i = 0; i < dataSet.rows; i++)
+	double sum = 0.0;
+	for (int k = 0; k < out.cols; k++)
 	{
-		calculateLayerOutputs(i);
+		double Yk = out.at<double>(0, k);
+		double Tk = label.at<double>(0, k);
+		sum -= Tk*std::log(Yk) + (1 - Tk)*std::log(1 - Yk);
+	}
 
-		double sum = 0.0;
-		for (int k = 0; k < softmaxOutput.cols; k++)
-		{
-			double Yk = softmaxOutput.at<double>(0, k);
-			double Tk = labels.row(i).at<double>(0, k);
-			sum += Tk*std::log(Yk);
-		}
-		sum /= dataSet.rows;
+	return sum;
+}
 
-		sumAll += sum;
+double ANN::softmaxError(const Mat & out, const Mat & label) const
+{
+	double sum = 0.0;
+	for (int k = 0; k < out.cols; k++)
+	{
+		double Yk = out.at<double>(0, k);
+		double Tk = label.at<double>(0, k);
+		sum -= Tk*std::log(Yk);
 	}
 
-	return sumAll;
-
-	return 0.0;
+	return sum;
 }
 
-double ANN::calculateHidden(Mat & input, Mat & pars)
+double ANN::calculateHidden(const Mat & input, const Mat & pars) const
 {
 	double dot = input.dot(pars);
 
@@ -333,7 +340,7 @@ double ANN::calculateHidden(Mat & input, Mat & pars)
 	{
 		double numerator = std::exp(dot) - std::exp(-dot);
 		double dominator = std::exp(dot) + std::exp(-dot);
-		double rst = numerator / dominator;
+		rst = numerator / dominator;
 	}
 
 	return rst;
@@ -348,11 +355,11 @@ double ANN::calculateSigmoid(Mat & input, Mat & pars)
 	return rst;
 }
 
-void ANN::calculateSigmoid(Mat & data)
+void ANN::calculateSigmoid(const Mat & data, Mat & rst) const
 {
-	double * ptr = data.ptr<double>(0);
-	double * sigmoidPtr = sigmoidOutput.ptr<double>(0);
-	for (int i = 0; i < softmaxOutput.cols; i++)
+	const double * ptr = data.ptr<double>(0);
+	double * sigmoidPtr = rst.ptr<double>(0);
+	for (int i = 0; i < data.cols; i++)
 	{
 		double e = std::exp(-*ptr);
 		e = 1 / (1 + e);
@@ -362,11 +369,11 @@ void ANN::calculateSigmoid(Mat & data)
 	}
 }
 
-void ANN::calculateSoftmax(Mat & data)
+void ANN::calculateSoftmax(const Mat & data, Mat & rst) const
 {
-	double * ptr = data.ptr<double>(0);
-	double * softPtr = softmaxOutput.ptr<double>(0);
-	for (int i = 0; i < softmaxOutput.cols; i++)
+	const double * ptr = data.ptr<double>(0);
+	double * softPtr = rst.ptr<double>(0);
+	for (int i = 0; i < data.cols; i++)
 	{
 		double e = std::exp(*ptr);
 		*softPtr = e;
@@ -374,13 +381,12 @@ void ANN::calculateSoftmax(Mat & data)
 		ptr++;
 	}
 
-	auto tmp = cv::sum(softmaxOutput);
+	auto tmp = cv::sum(rst);
 	double sum = tmp.val[0];
-	for (int i = 0; i < softmaxOutput.cols; i++)
+	softPtr = rst.ptr<double>(0);
+	for (int i = 0; i < data.cols; i++)
 	{
 		*softPtr = *softPtr / sum;
 		softPtr++;
-		ptr++;
 	}
 }
-
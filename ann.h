@@ -5,6 +5,7 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
+#include <functional>
 
 #include "mlbase.h"
 
@@ -77,6 +78,14 @@ public:
 	{
 		return errors;
 	}
+	vector<double> & showLossFuncVals() override
+	{
+		return errors;
+	}
+	const vector<double> & showLossFuncVals() const override
+	{
+		return errors;
+	}
 
 private:
 	Mat labels;
@@ -102,18 +111,23 @@ private:
 	ActFunc func;
 
 private:
+	void saveState(cv::FileStorage & fs) const override;
+	void loadState(const cv::FileNode & node) override;
+	double validationLoss(const Mat & data, const Mat & targets) const override;
 	void initParameters(double lowRange, double highRange);
 	void calculateParameters(int index);
 	void calculateLayerOutputs(int index);
-	void calculateLayerOutputs(Mat & data);
+	void calculateLayerOutputs(const Mat & data);
+	void forward(const Mat & data, Mat & hidden, 
+		Mat & linear, Mat & activated) const;
 
-	double calculateHidden(Mat & input, Mat & pars);
+	double calculateHidden(const Mat & input, const Mat & pars) const;
 	double calculateSigmoid(Mat & input, Mat & pars);
-	void calculateSigmoid(Mat & data);
-	void calculateSoftmax(Mat & data);
+	void calculateSigmoid(const Mat & data, Mat & rst) const;
+	void calculateSoftmax(const Mat & data, Mat & rst) const;
 
-	double errorCalculate(ActFunc func);
-	double squareError();
-	double sigmoidError();
-	double softmaxError();
+	double errorCalculate(const Mat & data, const Mat & targets, ActFunc func) const;
+	double squareError(const Mat & out, const Mat & label) const;
+	double sigmoidError(const Mat & out, const Mat & label) const;
+	double softmaxError(const Mat & out, const Mat & label) const;
 };
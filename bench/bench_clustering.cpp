@@ -0,0 +1,296 @@
+#include <benchmark/benchmark.h>
+
+#include "synthetic.h"
+#include "kmeans.h"
+#include "gmm.h"
+#include "productquantizer.h"
+
+//Training runs a fixed number of iterations, so the items processed are
+//sample-iterations and the rate is comparable across N, D and K
+
+static void BM_KmeansTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	int k = static_cast<int>(state.range(2));
+	Mat data, labels;
+	makeBlobs(n, d, k, data, labels);
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		Kmeans model(data, k, 0.0, 20);
+		model.train();
+		iters += model.showErrors().size();
+		benchmark::DoNotOptimize(model.showMeans().data);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters) * n);
+}
+BENCHMARK(BM_KmeansTrain)
+	->ArgsProduct({ { 1000, 10000, 100000 }, { 8, 64 }, { 4, 32 } })
+	->ArgNames({ "N", "D", "K" })
+	->Unit(benchmark::kMillisecond);
+
+//Bisecting training at large K, the items are the samples clustered
+static void BM_KmeansBisecting(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int k = static_cast<int>(state.range(1));
+	Mat data, labels;
+	makeBlobs(n, 32, k, data, labels);
+
+	for (auto _ : state)
+	{
+		Kmeans model(data, k, 0.005, 10);
+		model.setBisecting(true);
+		model.train();
+		benchmark::DoNotOptimize(model.showMeans().data);
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_KmeansBisecting)
+	->ArgsProduct({ { 100000 }, { 1024, 8192 } })
+	->ArgNames({ "N", "K" })
+	->Unit(benchmark::kMillisecond);
+
+//The same blobs under every metric, the rows are scaled to unit length
+//for the spherical k-means
+static void BM_KmeansMetric(benchmark::State & state)
+{
+	auto metric = static_cast<Kmeans::Metric>(state.range(0));
+	int n = 10000, d = 64, k = 32;
+	Mat data, labels;
+	makeBlobs(n, d, k, data, labels);
+	if (metric == Kmeans::COSINE)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			Mat row = data.row(i);
+			cv::normalize(row, row);
+		}
+	}
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		Kmeans model(data, k, 0.0, 20);
+		model.setMetric(metric);
+		model.train();
+		iters += model.showErrors().size();
+		benchmark::DoNotOptimize(model.showMeans().data);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters) * n);
+}
+BENCHMARK(BM_KmeansMetric)
+	->Arg(Kmeans::SQEUCLIDEAN)->Arg(Kmeans::COSINE)->Arg(Kmeans::MANHATTAN)
+	->ArgName("metric")
+	->Unit(benchmark::kMillisecond);
+
+static void BM_KmeansPredict(benchmark::State & state)
+{
+	int d = static_cast<int>(state.range(0));
+	int k = static_cast<int>(state.range(1));
+	Mat data, labels;
+	makeBlobs(4096, d, k, data, labels);
+	Kmeans model(data, k, 0.0, 10);
+	model.train();
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ & 4095);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KmeansPredict)
+	->ArgsProduct({ { 8, 64 }, { 4, 32 } })
+	->ArgNames({ "D", "K" });
+
+//Predict with K = 4096 means, width 0 scans all the means and the other
+//widths search the centroid tree. The recall is measured against the scan
+static void BM_KmeansIndexedPredict(benchmark::State & state)
+{
+	int width = static_cast<int>(state.range(0));
+	int n = 16384, d = 64, k = 4096;
+	Mat data, labels;
+	makeBlobs(n, d, k, data, labels);
+	Kmeans model(data, k, 0.0, 2);
+	model.train();
+	vector<int> exact = model.predictBatch(data);
+	if (width > 0)
+	{
+		model.buildIndex();
+		model.setSearchWidth(width);
+	}
+
+	vector<int> found = model.predictBatch(data);
+	int hits = 0;
+	for (int i = 0; i < n; i++)
+		hits += found[i] == exact[i];
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ % n);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["recall"] = static_cast<double>(hits) / n;
+}
+BENCHMARK(BM_KmeansIndexedPredict)
+	->Arg(0)->Arg(1)->Arg(4)->Arg(16)
+	->ArgName("width");
+
+static void BM_GMMTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	int k = static_cast<int>(state.range(2));
+	Mat data, labels;
+	makeBlobs(n, d, k, data, labels);
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		GMM model(data, k, 10, 1e-12);
+		model.train();
+		iters += model.showLossFuncVals().size();
+		benchmark::DoNotOptimize(model.showMeans().data);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters) * n);
+}
+BENCHMARK(BM_GMMTrain)
+	->ArgsProduct({ { 1000, 10000 }, { 4, 16 }, { 2, 8 } })
+	->ArgNames({ "N", "D", "K" })
+	->Unit(benchmark::kMillisecond);
+
+//Coreset of m samples against the full data set (m = 0), the counter is
+//the log-likelihood of the full data set after the refinement
+static void BM_GMMCoreset(benchmark::State & state)
+{
+	int m = static_cast<int>(state.range(0));
+	Mat data, labels;
+	makeBlobs(100000, 8, 8, data, labels);
+
+	double loss = 0.0;
+	for (auto _ : state)
+	{
+		GMM model(data, 8, 50, 1e-6);
+		model.setCoreset(m);
+		model.train();
+		loss = model.showLossFuncVals().back();
+		benchmark::DoNotOptimize(model.showMeans().data);
+	}
+	state.counters["loglik"] = loss;
+}
+BENCHMARK(BM_GMMCoreset)
+	->Arg(0)->Arg(2000)->Arg(8000)
+	->ArgName("m")
+	->Unit(benchmark::kMillisecond);
+
+//Variational weights with a validation set: K = 16 components on 4 blobs
+//are pruned during training, and training ends by restoring the model of
+//the best validation epoch. The restored model must have the components
+//it had at that epoch, even when later epochs pruned some of them
+static void BM_GMMPrunedValidation(benchmark::State & state)
+{
+	Mat data, labels, valid, validLabels;
+	makeBlobs(8192, 4, 4, data, labels);
+	makeBlobs(2048, 4, 4, valid, validLabels, benchSeed + 1);
+
+	int prunedAfterBest = 0;
+	for (auto _ : state)
+	{
+		GMM model(data, 16, 60, 1e-12);
+		model.setDirichletPrior(1e-3, 0.02);
+		model.setValidation(valid, Mat(), 60);
+		vector<int> components;
+		model.getTelemetry().addCallback([&](const Telemetry::Iteration &)
+		{
+			components.push_back(model.numOfComponents());
+		});
+		model.train();
+
+		auto & losses = model.showValidationLosses();
+		if (losses.empty() || losses.size() != components.size())
+		{
+			state.SkipWithError("Every epoch must be validated!");
+			break;
+		}
+		auto best = std::min_element(losses.begin(), losses.end()) - losses.begin();
+		if (model.numOfComponents() != components[best])
+		{
+			state.SkipWithError("The best validation model was not restored!");
+			break;
+		}
+		prunedAfterBest = components[best] - components.back();
+	}
+	state.counters["prunedAfterBest"] = prunedAfterBest;
+}
+BENCHMARK(BM_GMMPrunedValidation)->Unit(benchmark::kMillisecond);
+
+static void BM_GMMPredict(benchmark::State & state)
+{
+	int d = static_cast<int>(state.range(0));
+	int k = static_cast<int>(state.range(1));
+	Mat data, labels;
+	makeBlobs(4096, d, k, data, labels);
+	GMM model(data, k, 5, 1e-12);
+	model.train();
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ & 4095);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GMMPredict)
+	->ArgsProduct({ { 4, 16 }, { 2, 8 } })
+	->ArgNames({ "D", "K" });
+
+//D = 64 doubles compressed to M bytes, M = 16 keeps 1/32 of the memory
+static void BM_PQEncode(benchmark::State & state)
+{
+	int m = static_cast<int>(state.range(0));
+	Mat data, labels;
+	makeBlobs(65536, 64, 64, data, labels);
+	ProductQuantizer pq(m, 256, 10);
+	pq.train(data.rowRange(0, 16384));
+
+	for (auto _ : state)
+	{
+		Mat codes = pq.encode(data);
+		benchmark::DoNotOptimize(codes.data);
+	}
+	state.SetItemsProcessed(state.iterations() * data.rows);
+}
+BENCHMARK(BM_PQEncode)
+	->Arg(8)->Arg(16)
+	->ArgName("M")
+	->Unit(benchmark::kMillisecond);
+
+static void BM_PQSearch(benchmark::State & state)
+{
+	int m = static_cast<int>(state.range(0));
+	Mat data, labels;
+	makeBlobs(262144, 64, 64, data, labels);
+	ProductQuantizer pq(m, 256, 10);
+	pq.train(data.rowRange(0, 16384));
+	Mat codes = pq.encode(data);
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		auto found = pq.search(data.row(i++ & 1023), codes, 10);
+		benchmark::DoNotOptimize(found.data());
+	}
+	state.SetItemsProcessed(state.iterations() * codes.rows);
+	state.SetBytesProcessed(state.iterations() * codes.total());
+}
+BENCHMARK(BM_PQSearch)
+	->Arg(8)->Arg(16)
+	->ArgName("M")
+	->Unit(benchmark::kMillisecond);
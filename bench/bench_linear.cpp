@@ -0,0 +1,168 @@
+#include <benchmark/benchmark.h>
+
+#include "synthetic.h"
+#include "linearegression.h"
+#include "perception.h"
+#include "fisher.h"
+#include "relief.h"
+
+static void BM_LinearRegressionTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	auto method = static_cast<LinearRegression::MethodType>(state.range(2));
+	Mat data, targets;
+	makeRegression(n, d, 1, data, targets);
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		LinearRegression model(data, targets, 20, 0.0, 0.01);
+		model.train(method);
+		iters += model.showErrors().size();
+		benchmark::DoNotOptimize(model.showParameters().data);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters) * n);
+}
+BENCHMARK(BM_LinearRegressionTrain)
+	->ArgsProduct({ { 1000, 100000 }, { 16, 256 },
+		{ LinearRegression::NORMAL, LinearRegression::RANDOM, LinearRegression::REGULATION } })
+	->ArgNames({ "N", "D", "method" })
+	->Unit(benchmark::kMillisecond);
+
+static void BM_LinearRegressionPredict(benchmark::State & state)
+{
+	int d = static_cast<int>(state.range(0));
+	Mat data, targets;
+	makeRegression(4096, d, 1, data, targets);
+	LinearRegression model(data, targets);
+	model.train(LinearRegression::REGULATION);
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ & 4095);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LinearRegressionPredict)->Arg(16)->Arg(256)->ArgName("D");
+
+static void BM_PerceptionTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	Mat data, labels;
+	makeTwoClasses(n, d, data, labels);
+	labels = labels * 2.0 - 1.0;
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		Perception model(labels, data, 0.01, 20);
+		model.train();
+		iters += model.showErrors().size();
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters) * n);
+}
+BENCHMARK(BM_PerceptionTrain)
+	->ArgsProduct({ { 1000, 100000 }, { 16, 256 } })
+	->ArgNames({ "N", "D" })
+	->Unit(benchmark::kMillisecond);
+
+//The dense and the sparse predict of the same model must agree, both add
+//the bias themselves. The data set is sparsified by zeroing small values
+static void BM_PerceptionPredict(benchmark::State & state)
+{
+	auto mode = static_cast<Perception::Mode>(state.range(0));
+	Mat data, labels;
+	makeTwoClasses(4096, 64, data, labels);
+	labels = labels * 2.0 - 1.0;
+	data.setTo(cv::Scalar(0.0), cv::abs(data) < 0.5);
+	CsrMatrix sparse = CsrMatrix::fromDense(data);
+	Perception model(labels, data, 0.01, 20);
+	model.setMode(mode);
+	model.train();
+
+	vector<int> sparsePredictions = model.predict(sparse);
+	for (int i = 0; i < data.rows; i++)
+	{
+		Mat point = data.row(i);
+		if (model.predict(point) != sparsePredictions[i])
+		{
+			state.SkipWithError("The dense and the sparse predict disagree!");
+			return;
+		}
+	}
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ & 4095);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerceptionPredict)
+	->Arg(Perception::VANILLA)->Arg(Perception::AVERAGED)->Arg(Perception::VOTED)
+	->ArgName("mode");
+
+static void BM_FisherTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	Mat class1, class2, labels;
+	makeBlobs(n / 2, d, 1, class1, labels, benchSeed);
+	makeBlobs(n / 2, d, 1, class2, labels, benchSeed + 1);
+
+	for (auto _ : state)
+	{
+		Fisher model(class1, class2);
+		model.train();
+		benchmark::DoNotOptimize(model.showParameters());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_FisherTrain)
+	->ArgsProduct({ { 1000, 100000 }, { 16, 256 } })
+	->ArgNames({ "N", "D" })
+	->Unit(benchmark::kMillisecond);
+
+static void BM_FisherScore(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	Mat class1, class2, labels;
+	makeBlobs(n / 2, d, 1, class1, labels, benchSeed);
+	makeBlobs(n / 2, d, 1, class2, labels, benchSeed + 1);
+	Fisher model(class1, class2);
+	model.train();
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(model.score(class1).data);
+	state.SetItemsProcessed(state.iterations() * class1.rows);
+}
+BENCHMARK(BM_FisherScore)
+	->ArgsProduct({ { 1000, 100000 }, { 16, 256 } })
+	->ArgNames({ "N", "D" });
+
+static void BM_ReliefExtract(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	int samples = 100;
+	Mat data, labels;
+	makeTwoClasses(n, d, data, labels);
+
+	for (auto _ : state)
+	{
+		Relief model(labels, data, samples);
+		model.extractFeatures(d / 2);
+		benchmark::DoNotOptimize(model.showReulst().data);
+	}
+	state.SetItemsProcessed(state.iterations() * samples);
+}
+BENCHMARK(BM_ReliefExtract)
+	->ArgsProduct({ { 1000, 10000 }, { 16, 64 } })
+	->ArgNames({ "N", "D" })
+	->Unit(benchmark::kMillisecond);
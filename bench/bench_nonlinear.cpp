@@ -0,0 +1,175 @@
+#include <benchmark/benchmark.h>
+
+#include "synthetic.h"
+#include "ann.h"
+#include "GaussProcess.h"
+
+//One-hot n*k label matrix for the k output units
+static Mat oneHot(const Mat & labels, int k)
+{
+	Mat result = Mat::zeros(labels.rows, k, CV_64FC1);
+	for (int i = 0; i < labels.rows; i++)
+		result.at<double>(i, static_cast<int>(labels.at<double>(i, 0))) = 1.0;
+
+	return result;
+}
+
+static void BM_ANNTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	int k = static_cast<int>(state.range(2));
+	Mat data, labels;
+	makeBlobs(n, d, k, data, labels);
+	Mat outputs = oneHot(labels, k);
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		ANN model(outputs, data);
+		model.setThresh(0.0);
+		model.train();
+		iters += model.showErrors().size();
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters));
+}
+BENCHMARK(BM_ANNTrain)
+	->ArgsProduct({ { 256, 1024 }, { 16, 64 }, { 2, 8 } })
+	->ArgNames({ "N", "D", "K" })
+	->Unit(benchmark::kMillisecond);
+
+static void BM_ANNPredict(benchmark::State & state)
+{
+	int d = static_cast<int>(state.range(0));
+	int k = static_cast<int>(state.range(1));
+	Mat data, labels;
+	makeBlobs(1024, d, k, data, labels);
+	Mat outputs = oneHot(labels, k);
+	ANN model(outputs, data);
+	model.train();
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ & 1023);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ANNPredict)
+	->ArgsProduct({ { 16, 64 }, { 2, 8 } })
+	->ArgNames({ "D", "K" });
+
+static void BM_GaussProcessTrain(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	Mat data, targets;
+	makeRegression(n, d, 1, data, targets);
+
+	size_t iters = 0;
+	for (auto _ : state)
+	{
+		GaussProcess model(targets, data, 0.01, 5);
+		model.setParameters(GaussPars(1.0, 1.0, 1.0, 1.0, 0.0, 0.0));
+		model.train();
+		iters += model.showErrors().size();
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(iters) * n);
+}
+BENCHMARK(BM_GaussProcessTrain)
+	->ArgsProduct({ { 128, 512 }, { 4, 16 } })
+	->ArgNames({ "N", "D" })
+	->Unit(benchmark::kMillisecond);
+
+//M outputs sharing one kernel matrix and one factorization
+static void BM_GaussProcessOutputs(benchmark::State & state)
+{
+	int m = static_cast<int>(state.range(0));
+	Mat data, targets;
+	makeRegression(512, 8, m, data, targets);
+
+	for (auto _ : state)
+	{
+		GaussProcess model(targets, data, 0.01, 5);
+		model.setParameters(GaussPars(1.0, 1.0, 1.0, 1.0, 0.0, 0.0));
+		model.train();
+		benchmark::DoNotOptimize(model.showErrors().data());
+	}
+	state.SetItemsProcessed(state.iterations() * m);
+}
+BENCHMARK(BM_GaussProcessOutputs)
+	->Arg(1)->Arg(4)->Arg(16)
+	->ArgName("M")
+	->Unit(benchmark::kMillisecond);
+
+static void BM_GaussProcessPredict(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	Mat data, targets;
+	makeRegression(n, d, 1, data, targets);
+	GaussProcess model(targets, data, 0.01, 1);
+	model.setParameters(GaussPars(1.0, 1.0, 1.0, 1.0, 0.0, 0.0));
+	model.train();
+
+	int i = 0;
+	for (auto _ : state)
+	{
+		Mat point = data.row(i++ % n);
+		benchmark::DoNotOptimize(model.predict(point));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GaussProcessPredict)
+	->ArgsProduct({ { 128, 512 }, { 4, 16 } })
+	->ArgNames({ "N", "D" });
+
+//Gradient descent against L-BFGS on the same kernel, the counter is the
+//final log-likelihood
+static void BM_GaussProcessOptimizer(benchmark::State & state)
+{
+	auto optimizer = static_cast<GaussProcess::OptimizerType>(state.range(0));
+	Mat data, targets;
+	makeRegression(256, 4, 1, data, targets);
+
+	double likelihood = 0.0;
+	for (auto _ : state)
+	{
+		GaussProcess model(targets, data, 0.001, 100);
+		model.setKernel(std::make_shared<RBFKernel>(1.0, 1.0) +
+			std::make_shared<WhiteKernel>(0.1));
+		model.setOptimizer(optimizer);
+		model.train();
+		likelihood = model.showErrors().back();
+	}
+	state.counters["loglik"] = likelihood;
+}
+BENCHMARK(BM_GaussProcessOptimizer)
+	->Arg(GaussProcess::PLAIN)->Arg(GaussProcess::QUASI_NEWTON)
+	->ArgName("optimizer")
+	->Unit(benchmark::kMillisecond);
+
+//Gram matrix and derivatives of an ARD Matern 5/2 + linear + noise kernel
+static void BM_KernelGram(benchmark::State & state)
+{
+	int n = static_cast<int>(state.range(0));
+	int d = static_cast<int>(state.range(1));
+	Mat data, targets;
+	makeRegression(n, d, 1, data, targets);
+	KernelPtr kernel = std::make_shared<Matern52Kernel>(1.0, vector<double>(d, 1.0)) +
+		std::make_shared<LinearKernel>(0.1) + std::make_shared<WhiteKernel>(0.01);
+
+	for (auto _ : state)
+	{
+		Mat k;
+		vector<Mat> grads;
+		kernel->gram(data, k, &grads);
+		benchmark::DoNotOptimize(k.data);
+	}
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+BENCHMARK(BM_KernelGram)
+	->ArgsProduct({ { 128, 512 }, { 4, 16 } })
+	->ArgNames({ "N", "D" })
+	->Unit(benchmark::kMillisecond);
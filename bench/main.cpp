@@ -0,0 +1,30 @@
+#include <cstdlib>
+#include <string>
+#include <benchmark/benchmark.h>
+#include <opencv2\core.hpp>
+
+#include "executor.h"
+#include "synthetic.h"
+
+//ML_BENCH_THREADS fixes the size of the shared pool. The pool size, the data
+//seed and the OpenCV version are written into the report context, so the
+//JSON output tells which configuration produced it
+int main(int argc, char ** argv)
+{
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	if (const char * threads = std::getenv("ML_BENCH_THREADS"))
+		Executor::global().setNumThreads(std::atoi(threads));
+
+	benchmark::AddCustomContext("executor_threads",
+		std::to_string(Executor::global().numThreads()));
+	benchmark::AddCustomContext("data_seed", std::to_string(benchSeed));
+	benchmark::AddCustomContext("opencv_version", CV_VERSION);
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	return 0;
+}
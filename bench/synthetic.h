@@ -0,0 +1,66 @@
+#pragma once
+
+#include <random>
+#include <opencv2\core.hpp>
+
+using cv::Mat;
+
+//Synthetic data sets for the benchmarks. Every generator is seeded, so two
+//runs of the suite always see the same data.
+const unsigned int benchSeed = 20170501;
+
+//n*d samples drawn around k centers, labels is n*1 with the center indices
+inline void makeBlobs(int n, int d, int k, Mat & data, Mat & labels,
+	unsigned int seed = benchSeed)
+{
+	std::default_random_engine e(seed);
+	std::uniform_real_distribution<double> center(-10.0, 10.0);
+	std::normal_distribution<double> noise(0.0, 1.0);
+
+	Mat centers(k, d, CV_64FC1);
+	for (int i = 0; i < k; i++)
+		for (int j = 0; j < d; j++)
+			centers.at<double>(i, j) = center(e);
+
+	data.create(n, d, CV_64FC1);
+	labels.create(n, 1, CV_64FC1);
+	for (int i = 0; i < n; i++)
+	{
+		int c = i % k;
+		const double * cPtr = centers.ptr<double>(c);
+		double * dataPtr = data.ptr<double>(i);
+		for (int j = 0; j < d; j++)
+			dataPtr[j] = cPtr[j] + noise(e);
+		labels.at<double>(i, 0) = c;
+	}
+}
+
+//targets = data*W' + noise, data is n*d and targets is n*m
+inline void makeRegression(int n, int d, int m, Mat & data, Mat & targets,
+	unsigned int seed = benchSeed)
+{
+	std::default_random_engine e(seed);
+	std::normal_distribution<double> normal(0.0, 1.0);
+
+	Mat weights(m, d, CV_64FC1);
+	for (int i = 0; i < m; i++)
+		for (int j = 0; j < d; j++)
+			weights.at<double>(i, j) = normal(e);
+
+	data.create(n, d, CV_64FC1);
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < d; j++)
+			data.at<double>(i, j) = normal(e);
+
+	cv::gemm(data, weights, 1.0, cv::noArray(), 0.0, targets, cv::GEMM_2_T);
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < m; j++)
+			targets.at<double>(i, j) += 0.1 * normal(e);
+}
+
+//Two separable classes, labels is n*1 holding 0 and 1
+inline void makeTwoClasses(int n, int d, Mat & data, Mat & labels,
+	unsigned int seed = benchSeed)
+{
+	makeBlobs(n, d, 2, data, labels, seed);
+}
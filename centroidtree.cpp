@@ -0,0 +1,151 @@
+#include "centroidtree.h"
+
+CentroidTree::CentroidTree(const Mat & c, Kmeans::Metric m,
+	int b, int l, Executor & e) :
+	metric(m), branching(b), leafSize(l), executor(&e)
+{
+	if (c.empty() || b < 2 || l < 1)
+		throw std::exception("Invalid parameters!");
+
+	c.copyTo(centroids);
+	vector<int> members(centroids.rows);
+	for (int i = 0; i < centroids.rows; i++)
+		members[i] = i;
+
+	nodes.resize(1);
+	split(0, members);
+}
+
+CentroidTree::CentroidTree(const Mat & c, Kmeans::Metric m,
+	vector<Node> n, vector<int> i) :
+	metric(m), branching(2), leafSize(1), executor(&Executor::global()),
+	nodes(std::move(n)), items(std::move(i))
+{
+	if (c.empty() || nodes.empty())
+		throw std::exception("Invalid parameters!");
+
+	c.copyTo(centroids);
+}
+
+//The children of a node are stored next to each other, so a node only
+//keeps the range of its children, or of its centroids in items for a leaf
+void CentroidTree::split(int node, const vector<int> & members)
+{
+	nodes[node].center = centerOf(members);
+	if (static_cast<int>(members.size()) <= leafSize)
+	{
+		makeLeaf(node, members);
+		return;
+	}
+
+	auto groups = partition(members);
+	if (groups.size() < 2)
+	{
+		makeLeaf(node, members);
+		return;
+	}
+
+	int first = static_cast<int>(nodes.size());
+	int last = first + static_cast<int>(groups.size());
+	nodes.resize(last);
+	nodes[node].first = first;
+	nodes[node].last = last;
+	nodes[node].leaf = false;
+	for (int g = first; g < last; g++)
+		split(g, groups[g - first]);
+}
+
+void CentroidTree::makeLeaf(int node, const vector<int> & members)
+{
+	nodes[node].first = static_cast<int>(items.size());
+	items.insert(items.end(), members.begin(), members.end());
+	nodes[node].last = static_cast<int>(items.size());
+	nodes[node].leaf = true;
+}
+
+//Clustering the centroids of a node, the empty groups are dropped
+vector<vector<int>> CentroidTree::partition(const vector<int> & members) const
+{
+	int n = static_cast<int>(members.size());
+	Mat subset(n, centroids.cols, CV_64FC1);
+	for (int i = 0; i < n; i++)
+	{
+		Mat row = subset.row(i);
+		centroids.row(members[i]).copyTo(row);
+	}
+
+	Kmeans k(subset, std::min(branching, n), 0.0, 10);
+	k.setMetric(metric);
+	k.setExecutor(*executor);
+	k.train();
+
+	vector<vector<int>> groups;
+	for (auto & kind : k.showKinds())
+	{
+		if (kind.empty())
+			continue;
+
+		groups.emplace_back();
+		for (auto ele : kind)
+			groups.back().push_back(members[ele]);
+	}
+
+	return groups;
+}
+
+Mat CentroidTree::centerOf(const vector<int> & members) const
+{
+	Mat center = Mat::zeros(1, centroids.cols, CV_64FC1);
+	for (auto ele : members)
+		center += centroids.row(ele);
+	center /= static_cast<double>(members.size());
+	if (metric == Kmeans::COSINE)
+		cv::normalize(center, center);
+
+	return center;
+}
+
+int CentroidTree::nearest(const Mat & point, int width) const
+{
+	width = std::max(width, 1);
+
+	int best = items.empty() ? -1 : items[0];
+	double bestDist = DBL_MAX;
+	vector<std::pair<double, int>> frontier(1, std::make_pair(0.0, 0));
+	vector<std::pair<double, int>> next;
+	while (!frontier.empty())
+	{
+		next.clear();
+		for (auto & ele : frontier)
+		{
+			const Node & node = nodes[ele.second];
+			if (node.leaf)
+			{
+				for (int i = node.first; i < node.last; i++)
+				{
+					double dist = Kmeans::distance(point, centroids.row(items[i]), metric);
+					if (dist < bestDist)
+					{
+						bestDist = dist;
+						best = items[i];
+					}
+				}
+				continue;
+			}
+
+			for (int c = node.first; c < node.last; c++)
+				next.push_back(std::make_pair(
+					Kmeans::distance(point, nodes[c].center, metric), c));
+		}
+
+		//Keeping the closest nodes of the next level
+		if (static_cast<int>(next.size()) > width)
+		{
+			std::nth_element(next.begin(), next.begin() + width, next.end());
+			next.resize(width);
+		}
+		frontier.swap(next);
+	}
+
+	return best;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cfloat>
+#include <opencv2\core.hpp>
+
+#include "kmeans.h"
+
+using cv::Mat;
+using std::vector;
+
+//Hierarchical k-means tree over a set of centroids. Every internal node
+//splits its centroids into at most `branching` groups with Kmeans, until a
+//group holds no more than `leafSize` centroids. A query descends the tree
+//level by level keeping the `width` closest nodes, and scans the centroids
+//of the leaves it reaches. The width trades recall for speed: the search is
+//exact once the width is as large as the number of nodes of a level.
+class CentroidTree
+{
+public:
+	//The children of an internal node are the nodes [first, last), the
+	//centroids of a leaf are the items [first, last)
+	struct Node
+	{
+		Mat center;
+		int first;
+		int last;
+		bool leaf;
+	};
+
+	CentroidTree(const Mat & centroids, Kmeans::Metric m,
+		int branching = 16, int leafSize = 32, Executor & e = Executor::global());
+	//A tree built elsewhere, e.g. by bisecting Kmeans, node 0 is the root
+	CentroidTree(const Mat & centroids, Kmeans::Metric m,
+		vector<Node> n, vector<int> i);
+
+	//Index of the nearest centroid found, point is a 1*D row
+	int nearest(const Mat & point, int width) const;
+
+	int numOfNodes() const { return static_cast<int>(nodes.size()); }
+	int numOfCentroids() const { return centroids.rows; }
+
+private:
+	Mat centroids;
+	Kmeans::Metric metric;
+	int branching;
+	int leafSize;
+	Executor * executor;
+	vector<Node> nodes;
+	vector<int> items;
+
+	void split(int node, const vector<int> & members);
+	void makeLeaf(int node, const vector<int> & members);
+	vector<vector<int>> partition(const vector<int> & members) const;
+	Mat centerOf(const vector<int> & members) const;
+};
@@ -0,0 +1,104 @@
+#include "csrmatrix.h"
+
+CsrMatrix::CsrMatrix() : numOfRows(0), numOfCols(0)
+{
+	auto s = std::make_shared<Storage>();
+	s->rowPtrs.push_back(0);
+	storage = s;
+}
+
+CsrMatrix::CsrMatrix(int r, int c, vector<double> && values,
+	vector<int> && colIndices, vector<int> && rowPtrs) :
+	numOfRows(r), numOfCols(c)
+{
+	if (r < 0 || c < 0 || rowPtrs.size() != static_cast<size_t>(r) + 1 ||
+		values.size() != colIndices.size() ||
+		static_cast<size_t>(rowPtrs.back()) != values.size())
+		throw std::exception("Invalid sparse matrix!");
+
+	auto s = std::make_shared<Storage>();
+	s->values = std::move(values);
+	s->colIndices = std::move(colIndices);
+	s->rowPtrs = std::move(rowPtrs);
+	storage = s;
+}
+
+CsrMatrix CsrMatrix::fromDense(const Mat & dense)
+{
+	vector<double> values;
+	vector<int> colIndices;
+	vector<int> rowPtrs(1, 0);
+	for (int i = 0; i < dense.rows; i++)
+	{
+		const double * dataPtr = dense.ptr<double>(i);
+		for (int j = 0; j < dense.cols; j++)
+		{
+			if (dataPtr[j] != 0.0)
+			{
+				values.push_back(dataPtr[j]);
+				colIndices.push_back(j);
+			}
+		}
+		rowPtrs.push_back(static_cast<int>(values.size()));
+	}
+
+	return CsrMatrix(dense.rows, dense.cols, std::move(values),
+		std::move(colIndices), std::move(rowPtrs));
+}
+
+Mat CsrMatrix::toDense() const
+{
+	Mat dense = Mat::zeros(numOfRows, numOfCols, CV_64FC1);
+	for (int i = 0; i < numOfRows; i++)
+		axpy(i, 1.0, dense.ptr<double>(i));
+
+	return dense;
+}
+
+double CsrMatrix::dot(int r, const double * dense) const
+{
+	const double * valPtr = rowValues(r);
+	const int * idxPtr = rowIndices(r);
+	int nnz = rowNonZeros(r);
+	double result = 0.0;
+	for (int k = 0; k < nnz; k++)
+		result += valPtr[k] * dense[idxPtr[k]];
+
+	return result;
+}
+
+void CsrMatrix::axpy(int r, double a, double * dense) const
+{
+	const double * valPtr = rowValues(r);
+	const int * idxPtr = rowIndices(r);
+	int nnz = rowNonZeros(r);
+	for (int k = 0; k < nnz; k++)
+		dense[idxPtr[k]] += a * valPtr[k];
+}
+
+double CsrMatrix::squareNorm(int r) const
+{
+	const double * valPtr = rowValues(r);
+	int nnz = rowNonZeros(r);
+	double result = 0.0;
+	for (int k = 0; k < nnz; k++)
+		result += valPtr[k] * valPtr[k];
+
+	return result;
+}
+
+Mat CsrMatrix::multiplyTransposed(const Mat & dense) const
+{
+	if (dense.cols != numOfCols)
+		throw std::exception("Invalid input matrix!");
+
+	Mat result(numOfRows, dense.rows, CV_64FC1);
+	for (int i = 0; i < numOfRows; i++)
+	{
+		double * rstPtr = result.ptr<double>(i);
+		for (int k = 0; k < dense.rows; k++)
+			rstPtr[k] = dot(i, dense.ptr<double>(k));
+	}
+
+	return result;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <opencv2\core.hpp>
+
+using cv::Mat;
+using std::vector;
+
+//Compressed sparse row matrix of doubles, every row is a sample.
+//Copies share the same storage, like cv::Mat headers do.
+class CsrMatrix
+{
+public:
+	CsrMatrix();
+	CsrMatrix(int r, int c, vector<double> && values,
+		vector<int> && colIndices, vector<int> && rowPtrs);
+
+	static CsrMatrix fromDense(const Mat & dense);
+	Mat toDense() const;
+
+	int rows() const { return numOfRows; }
+	int cols() const { return numOfCols; }
+	size_t nonZeros() const { return storage->values.size(); }
+	bool empty() const { return numOfRows == 0; }
+
+	//Raw access to the non-zero elements of one row
+	int rowNonZeros(int r) const
+	{
+		return storage->rowPtrs[r + 1] - storage->rowPtrs[r];
+	}
+	const double * rowValues(int r) const
+	{
+		return storage->values.data() + storage->rowPtrs[r];
+	}
+	const int * rowIndices(int r) const
+	{
+		return storage->colIndices.data() + storage->rowPtrs[r];
+	}
+
+	//Sparse-dense kernels, dense points to cols() doubles
+	double dot(int r, const double * dense) const;
+	void axpy(int r, double a, double * dense) const;
+	double squareNorm(int r) const;
+
+	//Returns this * dense', where dense is a k*cols() matrix
+	Mat multiplyTransposed(const Mat & dense) const;
+
+private:
+	struct Storage
+	{
+		vector<double> values;
+		vector<int> colIndices;
+		vector<int> rowPtrs;
+	};
+
+	int numOfRows;
+	int numOfCols;
+	std::shared_ptr<const Storage> storage;
+};
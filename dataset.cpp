@@ -0,0 +1,220 @@
+#include "dataset.h"
+
+#include <fstream>
+#include <cstring>
+
+namespace
+{
+	//64 bytes, so the samples start at a cache line aligned offset
+	struct FileHeader
+	{
+		char magic[8];
+		std::int32_t layout;
+		std::int32_t reserved;
+		std::int64_t rows;
+		std::int64_t features;
+		std::int64_t labels;
+		char padding[24];
+	};
+
+	const char fileMagic[8] = { 'M', 'L', 'D', 'S', 'E', 'T', '0', '1' };
+
+#if CV_VERSION_MAJOR >= 4
+	typedef cv::AccessFlag AccessFlags;
+#else
+	typedef int AccessFlags;
+#endif
+
+	//Allocates nothing. The views over a mapping carry a UMatData whose
+	//userdata is a reference to the MappedFile, so the reference count of
+	//the Mat headers keeps the file mapped
+	class MappingAllocator : public cv::MatAllocator
+	{
+	public:
+		cv::UMatData * allocate(int dims, const int * sizes, int type, void * data,
+			size_t * step, AccessFlags flags, cv::UMatUsageFlags usage) const override
+		{
+			return nullptr;
+		}
+		bool allocate(cv::UMatData * u, AccessFlags flags,
+			cv::UMatUsageFlags usage) const override
+		{
+			return false;
+		}
+		void deallocate(cv::UMatData * u) const override
+		{
+			delete static_cast<std::shared_ptr<MappedFile> *>(u->userdata);
+			delete u;
+		}
+	};
+
+	const cv::MatAllocator * mappingAllocator()
+	{
+		static MappingAllocator allocator;
+		return &allocator;
+	}
+}
+
+Dataset::Dataset() :
+	numOfRows(0), numOfFeats(0), numOfLabs(0), order(ROW), base(nullptr)
+{
+}
+
+Dataset::Dataset(const std::string & path) :
+	numOfRows(0), numOfFeats(0), numOfLabs(0), order(ROW), base(nullptr)
+{
+	auto m = std::make_shared<MappedFile>(path);
+	if (m->size() < sizeof(FileHeader))
+		throw std::exception("Invalid data set file!");
+
+	FileHeader header;
+	std::memcpy(&header, m->data(), sizeof(header));
+	if (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0 ||
+		(header.layout != ROW && header.layout != COLUMN) ||
+		header.rows < 0 || header.features < 0 || header.labels < 0 ||
+		header.rows > INT32_MAX || header.features + header.labels > INT32_MAX)
+		throw std::exception("Invalid data set file!");
+
+	std::uint64_t count = static_cast<std::uint64_t>(header.rows) *
+		static_cast<std::uint64_t>(header.features + header.labels);
+	if (count > (m->size() - sizeof(FileHeader)) / sizeof(double))
+		throw std::exception("Truncated data set file!");
+
+	numOfRows = static_cast<int>(header.rows);
+	numOfFeats = static_cast<int>(header.features);
+	numOfLabs = static_cast<int>(header.labels);
+	order = static_cast<Layout>(header.layout);
+	base = reinterpret_cast<double *>(m->data() + sizeof(FileHeader));
+	mapping = m;
+}
+
+void Dataset::save(const std::string & path, const Mat & features,
+	const Mat & labels, Layout layout)
+{
+	if (!labels.empty() && labels.rows != features.rows)
+		throw std::exception("Invalid input data!");
+
+	Mat feats, labs;
+	features.convertTo(feats, CV_64FC1);
+	if (!labels.empty())
+		labels.convertTo(labs, CV_64FC1);
+	else
+		labs = Mat(features.rows, 0, CV_64FC1);
+
+	FileHeader header = {};
+	std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+	header.layout = layout;
+	header.rows = feats.rows;
+	header.features = feats.cols;
+	header.labels = labs.cols;
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+		throw std::exception("Cannot create the data set file!");
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+	if (layout == ROW)
+	{
+		for (int i = 0; i < feats.rows; i++)
+		{
+			out.write(feats.ptr<char>(i), feats.cols * sizeof(double));
+			out.write(labs.ptr<char>(i), labs.cols * sizeof(double));
+		}
+	}
+	else
+	{
+		//Transposing once, so every column is written contiguously
+		Mat cols;
+		if (feats.cols > 0)
+		{
+			cv::transpose(feats, cols);
+			out.write(cols.ptr<char>(0), cols.total() * sizeof(double));
+		}
+		if (labs.cols > 0)
+		{
+			cv::transpose(labs, cols);
+			out.write(cols.ptr<char>(0), cols.total() * sizeof(double));
+		}
+	}
+
+	if (!out)
+		throw std::exception("Cannot write the data set file!");
+}
+
+Mat Dataset::features() const
+{
+	if (order == ROW)
+		return view(numOfRows, numOfFeats, base,
+			(numOfFeats + numOfLabs) * sizeof(double));
+
+	Mat result;
+	cv::transpose(featureColumns(), result);
+	return result;
+}
+
+Mat Dataset::labels() const
+{
+	if (order == ROW)
+		return view(numOfRows, numOfLabs, base + numOfFeats,
+			(numOfFeats + numOfLabs) * sizeof(double));
+
+	//A single label column is already contiguous
+	if (numOfLabs == 1)
+		return column(numOfFeats);
+
+	Mat result;
+	cv::transpose(Mat(numOfLabs, numOfRows, CV_64FC1,
+		base + static_cast<size_t>(numOfFeats) * numOfRows), result);
+	return result;
+}
+
+Mat Dataset::featureColumns() const
+{
+	if (order == COLUMN)
+		return view(numOfFeats, numOfRows, base);
+
+	Mat result;
+	cv::transpose(features(), result);
+	return result;
+}
+
+Mat Dataset::feature(int j) const
+{
+	if (j < 0 || j >= numOfFeats)
+		throw std::exception("Invalid feature index!");
+
+	return column(j);
+}
+
+Mat Dataset::label(int j) const
+{
+	if (j < 0 || j >= numOfLabs)
+		throw std::exception("Invalid label index!");
+
+	return column(numOfFeats + j);
+}
+
+Mat Dataset::column(int j) const
+{
+	if (order == ROW)
+		return view(numOfRows, 1, base + j,
+			(numOfFeats + numOfLabs) * sizeof(double));
+
+	return view(numOfRows, 1, base + static_cast<size_t>(j) * numOfRows);
+}
+
+Mat Dataset::view(int rows, int cols, double * data, size_t step) const
+{
+	Mat result(rows, cols, CV_64FC1, data, step);
+	if (!mapping || result.empty())
+		return result;
+
+	cv::UMatData * u = new cv::UMatData(mappingAllocator());
+	u->data = u->origdata = reinterpret_cast<uchar *>(data);
+	u->size = result.step[0] * (rows - 1) + result.elemSize() * cols;
+	u->userdata = new std::shared_ptr<MappedFile>(mapping);
+	u->refcount = 1;
+	result.u = u;
+
+	return result;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <opencv2\core.hpp>
+
+#include "mappedfile.h"
+
+using cv::Mat;
+
+//Data set stored in a binary file and mapped into memory. The file holds a
+//fixed header followed by N samples of D features and L labels as doubles,
+//either sample by sample (ROW) or column by column (COLUMN). The views
+//returned below point into the mapping, so loading costs no parsing and no
+//copies. The mapping is copy-on-write: writing into a view never touches the
+//file. Every view holds a reference to the mapping, which is unmapped with
+//the last view or Dataset using it, so views may outlive their Dataset.
+class Dataset
+{
+public:
+	enum Layout { ROW, COLUMN };
+
+	Dataset();
+	explicit Dataset(const std::string & path);
+
+	//Writes features (N*D) and labels (N*L, may be empty) in the given layout
+	static void save(const std::string & path, const Mat & features,
+		const Mat & labels, Layout layout = ROW);
+
+	int numOfSamples() const { return numOfRows; }
+	int numOfFeatures() const { return numOfFeats; }
+	int numOfLabels() const { return numOfLabs; }
+	Layout layout() const { return order; }
+	bool empty() const { return numOfRows == 0; }
+
+	//N*D and N*L matrices, every row is a sample. Zero-copy strided views for
+	//the ROW layout, COLUMN files are transposed into a new matrix
+	Mat features() const;
+	Mat labels() const;
+
+	//D*N matrix, every column is a sample. Zero-copy for the COLUMN layout
+	Mat featureColumns() const;
+
+	//N*1 views of a single feature or label, zero-copy for both layouts
+	Mat feature(int j) const;
+	Mat label(int j) const;
+
+private:
+	int numOfRows;
+	int numOfFeats;
+	int numOfLabs;
+	Layout order;
+	double * base;
+	std::shared_ptr<MappedFile> mapping;
+
+	//Returns the N*1 view of column j, where j counts features then labels
+	Mat column(int j) const;
+	//Mat header over the mapping that shares its ownership
+	Mat view(int rows, int cols, double * data, size_t step = Mat::AUTO_STEP) const;
+};
@@ -0,0 +1,219 @@
+#include "executor.h"
+
+#include <chrono>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+Executor::Executor(int n, bool pin) :
+	stopping(false), queued(0), pinned(pin)
+{
+	start(n);
+}
+
+Executor::~Executor()
+{
+	stop();
+}
+
+Executor & Executor::global()
+{
+	static Executor executor;
+	return executor;
+}
+
+//Must not be called while a parallel loop is running
+void Executor::setNumThreads(int n)
+{
+	stop();
+	start(n);
+}
+
+void Executor::setAffinity(bool pin)
+{
+	if (pin == pinned)
+		return;
+
+	int n = numThreads();
+	stop();
+	pinned = pin;
+	start(n);
+}
+
+void Executor::parallelFor(int begin, int end,
+	const std::function<void(int, int)> & body, int grain)
+{
+	if (end <= begin)
+		return;
+
+	int chunks = numOfChunks(end - begin, grain);
+	if (chunks <= 1 || workers.empty())
+	{
+		body(begin, end);
+		return;
+	}
+
+	//Dealing the chunks round-robin, idle workers steal the rest
+	auto job = std::make_shared<Job>();
+	job->pending = chunks;
+	long long size = end - begin;
+	for (int c = 0; c < chunks; c++)
+	{
+		Task task;
+		task.body = &body;
+		task.first = begin + static_cast<int>(size * c / chunks);
+		task.last = begin + static_cast<int>(size * (c + 1) / chunks);
+		task.job = job;
+
+		Queue & queue = *queues[c % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued += chunks;
+	}
+	sleepCond.notify_all();
+
+	//The caller works until its own job is done
+	while (job->pending > 0)
+	{
+		if (runOne(-1))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		doneCond.wait_for(lock, std::chrono::milliseconds(1),
+			[&] { return job->pending == 0; });
+	}
+
+	if (job->error)
+		std::rethrow_exception(job->error);
+}
+
+void Executor::start(int n)
+{
+	int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	if (n <= 0)
+		n = cores;
+
+	for (int i = 0; i < n - 1; i++)
+		queues.emplace_back(new Queue);
+	for (int i = 0; i < n - 1; i++)
+	{
+		workers.emplace_back(&Executor::workerLoop, this, i);
+		if (pinned)
+			pinThread(workers.back(), (i + 1) % cores);
+	}
+}
+
+void Executor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	sleepCond.notify_all();
+
+	for (auto & ele : workers)
+		ele.join();
+	workers.clear();
+	queues.clear();
+	stopping = false;
+}
+
+void Executor::workerLoop(int id)
+{
+	while (!stopping)
+	{
+		if (runOne(id))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepCond.wait(lock, [&] { return stopping || queued > 0; });
+	}
+}
+
+//Pops from the back of the own queue, otherwise steals from the front
+//of the other queues. id is -1 for threads outside the pool
+bool Executor::runOne(int id)
+{
+	int n = static_cast<int>(queues.size());
+	for (int i = 0; i < n; i++)
+	{
+		int index = id < 0 ? i : (id + i) % n;
+		Queue & queue = *queues[index];
+		std::unique_lock<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		Task task;
+		if (index == id)
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+		lock.unlock();
+
+		queued--;
+		runTask(task);
+		return true;
+	}
+
+	return false;
+}
+
+void Executor::runTask(Task & task)
+{
+	try
+	{
+		(*task.body)(task.first, task.last);
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(task.job->mutex);
+		if (!task.job->error)
+			task.job->error = std::current_exception();
+	}
+
+	if (--task.job->pending == 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		doneCond.notify_all();
+	}
+}
+
+void Executor::pinThread(std::thread & t, int core)
+{
+#ifdef _WIN32
+	SetThreadAffinityMask(t.native_handle(), static_cast<DWORD_PTR>(1) << (core % 64));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+	(void)t;
+	(void)core;
+#endif
+}
+
+int Executor::numOfChunks(int size, int grain) const
+{
+	grain = std::max(1, grain);
+	long long chunks = (static_cast<long long>(size) + grain - 1) / grain;
+	return static_cast<int>(std::max(1LL,
+		std::min(chunks, static_cast<long long>(numThreads()) * 4)));
+}
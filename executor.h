@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <exception>
+
+using std::vector;
+
+//Work-stealing thread pool shared by all the learners. The calling thread
+//takes part in every parallel loop, so nested loops cannot deadlock, and
+//one pool per process keeps several models from oversubscribing the cores.
+class Executor
+{
+public:
+	//n is the number of threads including the caller, 0 means all cores
+	explicit Executor(int n = 0, bool pin = false);
+	Executor(const Executor &) = delete;
+	Executor & operator= (const Executor &) = delete;
+	~Executor();
+
+	static Executor & global();
+
+	void setNumThreads(int n);
+	int numThreads() const { return static_cast<int>(workers.size()) + 1; }
+	void setAffinity(bool pin);
+	bool affinity() const { return pinned; }
+
+	//Runs body(first, last) over sub-ranges of [begin, end), every
+	//sub-range holds at least grain elements
+	void parallelFor(int begin, int end,
+		const std::function<void(int, int)> & body, int grain = 1);
+
+	//Maps every sub-range to a partial result and folds the partial
+	//results in order, so the result does not depend on the scheduling
+	template <typename T, typename Map, typename Reduce>
+	T parallelReduce(int begin, int end, T identity,
+		Map map, Reduce reduce, int grain = 1);
+
+private:
+	struct Job
+	{
+		std::atomic<int> pending;
+		std::exception_ptr error;
+		std::mutex mutex;
+	};
+
+	struct Task
+	{
+		std::function<void(int, int)> const * body;
+		int first;
+		int last;
+		std::shared_ptr<Job> job;
+	};
+
+	struct Queue
+	{
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	vector<std::thread> workers;
+	vector<std::unique_ptr<Queue>> queues;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCond;
+	std::condition_variable doneCond;
+	std::atomic<bool> stopping;
+	std::atomic<int> queued;
+	bool pinned;
+
+	void start(int n);
+	void stop();
+	void workerLoop(int id);
+	bool runOne(int id);
+	void runTask(Task & task);
+	void pinThread(std::thread & t, int core);
+	int numOfChunks(int size, int grain) const;
+};
+
+template <typename T, typename Map, typename Reduce>
+T Executor::parallelReduce(int begin, int end, T identity,
+	Map map, Reduce reduce, int grain)
+{
+	if (end <= begin)
+		return identity;
+
+	int chunks = numOfChunks(end - begin, grain);
+	vector<T> partials(chunks, identity);
+	parallelFor(0, chunks, [&](int first, int last)
+	{
+		for (int c = first; c < last; c++)
+		{
+			long long size = end - begin;
+			int from = begin + static_cast<int>(size * c / chunks);
+			int to = begin + static_cast<int>(size * (c + 1) / chunks);
+			partials[c] = map(from, to);
+		}
+	});
+
+	T result = identity;
+	for (auto & ele : partials)
+		result = reduce(result, ele);
+
+	return result;
+}
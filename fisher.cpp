@@ -2,58 +2,152 @@
 
 void Fisher::train()
 {
-	Mat tmpMat;
-
-	//Calculating mean of Class1
-	for (int i = 0; i < class1.cols; i++)
+	telemetry.beginTraining();
 	{
-		mean1 = mean1 + class1.col(i);
-	}
-	mean1 = mean1 / class1.cols;
+		Telemetry::Timer timer(telemetry, Telemetry::UPDATE);
+		if (isSparse())
+			calculateSparseStatistics();
+		else
+		{
+			//Calculating mean and covariance matrix of both classes
+			Mat S1 = calculateScatter(class1, mean1);
+			Mat S2 = calculateScatter(class2, mean2);
 
-	//Calculation mean of Class2
-	for (int i = 0; i < class2.cols; i++)
-	{
-		mean2 = mean2 + class2.col(i);
+			//Calculating covariance matrix of within-class
+			cv::add(S1, S2, Sw);
+		}
 	}
-	mean2 / class2.cols;
 
 	//Calculating threshold, namely w0
-	threshold = 
-		(class1.cols * mean1 + class2.cols*mean2) / (class1.cols + class2.cols);
+	int n1 = isSparse() ? sparse1.rows() : class1.rows;
+	int n2 = isSparse() ? sparse2.rows() : class2.rows;
+	threshold = (n1 * mean1 + n2 * mean2) / (n1 + n2);
 
-	//Calculating covariance matrix of Class1
-	Mat S1;
-	S1 = Mat::zeros(class1.rows, class1.rows, CV_64FC1);
-	for (int i = 0; i < class1.cols; i++)
+	//Calculating parameter vector W
 	{
-		S1 = S1 + (class1.col(i) - mean1)*(class1.col(i) - mean1).t();
+		Telemetry::Timer timer(telemetry, Telemetry::SOLVE);
+		cv::solve(Sw, mean1 - mean2, parameters, cv::DECOMP_LU);
 	}
-	S1 = S1 / (class1.cols - 1);
 
-	//Calculating covariance matrix of Class2
-	Mat S2;
-	S2 = Mat::zeros(class1.rows, class1.rows, CV_64FC1);
-	for (int i = 0; i < class2.cols; i++)
+	//Folding the threshold into the bias, so prediction is one dot product
+	w0 = -parameters.dot(threshold);
+	telemetry.endIteration(0.0, n1 + n2);
+	telemetry.endTraining();
+}
+
+//data must be a n*1 matrix!
+int Fisher::predict(const Mat & data) const
+{
+	double result = parameters.dot(data) + w0;
+
+	return result > 0 ? 1 : 0;
+}
+
+//datas must be a N*n matrix, every row is a sample
+vector<int> Fisher::predictBatch(const Mat & datas) const
+{
+	Mat scores = score(datas);
+	vector<int> result(scores.rows);
+	for (int i = 0; i < scores.rows; i++)
+		result[i] = scores.at<double>(i, 0) > 0 ? 1 : 0;
+
+	return result;
+}
+
+//Returns the N*1 discriminant scores of datas
+Mat Fisher::score(const Mat & datas) const
+{
+	if (datas.cols != parameters.rows)
+		throw std::exception("Invalid input data!");
+
+	//Every block of rows runs its own GEMV
+	Mat scores(datas.rows, 1, CV_64FC1);
+	executor->parallelFor(0, datas.rows, [&](int first, int last)
 	{
-		S2 = S2 + (class2.col(i) - mean2)*(class2.col(i) - mean2).t();
-	}
-	S2 = S2 / (class2.cols - 1);
+		Mat block = scores.rowRange(first, last);
+		cv::gemm(datas.rowRange(first, last), parameters, 1.0, cv::noArray(), 0.0, block);
+		for (int i = 0; i < block.rows; i++)
+			block.at<double>(i, 0) += w0;
+	}, 1024);
 
-	//Calculating covariance matrix of within-class
-	Sw = S1 + S2;
+	return scores;
+}
 
-	//Calculating parameter vector W
-	parameters = Sw.inv() * (mean1 - mean2);
+vector<int> Fisher::predictBatch(const CsrMatrix & datas) const
+{
+	Mat scores = score(datas);
+	vector<int> result(scores.rows);
+	for (int i = 0; i < scores.rows; i++)
+		result[i] = scores.at<double>(i, 0) > 0 ? 1 : 0;
+
+	return result;
+}
+
+//Sparse-dense GEMV over the rows of datas
+Mat Fisher::score(const CsrMatrix & datas) const
+{
+	if (datas.cols() != parameters.rows)
+		throw std::exception("Invalid input data!");
+
+	Mat scores(datas.rows(), 1, CV_64FC1);
+	executor->parallelFor(0, datas.rows(), [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+			scores.at<double>(i, 0) = datas.dot(i, parameters.ptr<double>(0)) + w0;
+	}, 1024);
+
+	return scores;
+}
+
+//Covariance of the rows of datas, the centered samples are multiplied
+//in one pass without copying datas
+Mat Fisher::calculateScatter(const Mat & datas, Mat & mean)
+{
+	Mat meanRow;
+	cv::reduce(datas, meanRow, 0, cv::REDUCE_AVG);
+	mean = meanRow.t();
+
+	Mat S;
+	cv::mulTransposed(datas, S, true, meanRow, 1.0 / (datas.rows - 1));
+
+	return S;
+}
+
+void Fisher::calculateSparseStatistics()
+{
+	Mat S1 = calculateSparseScatter(sparse1, mean1);
+	Mat S2 = calculateSparseScatter(sparse2, mean2);
+	cv::add(S1, S2, Sw);
 }
 
-int Fisher::predict(Mat & data)
+//Covariance (sum(x*x') - n*mean*mean')/(n-1) built from the non-zero
+//elements of every sample only
+Mat Fisher::calculateSparseScatter(const CsrMatrix & datas, Mat & mean)
 {
-	Mat resultMat = parameters.t() * (data - threshold);
-	w0 = ((vector<double>)(resultMat.reshape(1,1))).front();
+	int n = datas.rows();
+	Mat S = Mat::zeros(datas.cols(), datas.cols(), CV_64FC1);
+	mean = Mat::zeros(datas.cols(), 1, CV_64FC1);
+	double * meanPtr = mean.ptr<double>(0);
+	for (int i = 0; i < n; i++)
+	{
+		const double * valPtr = datas.rowValues(i);
+		const int * idxPtr = datas.rowIndices(i);
+		int nnz = datas.rowNonZeros(i);
+		for (int a = 0; a < nnz; a++)
+		{
+			meanPtr[idxPtr[a]] += valPtr[a];
+			double * sPtr = S.ptr<double>(idxPtr[a]);
+			for (int b = 0; b < nnz; b++)
+				sPtr[idxPtr[b]] += valPtr[a] * valPtr[b];
+		}
+	}
+	//The outer product is folded into the GEMM, S is updated in place
+	mean /= n;
+	cv::gemm(mean, mean, -n, S, 1.0, S, cv::GEMM_2_T);
+	S /= n - 1;
 
-	return w0 > 0 ? 1 : 0;
-} 
+	return S;
+}
 
 vector<double> Fisher::showParameters()
 {
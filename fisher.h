@@ -5,6 +5,7 @@
 #include <opencv2\opencv.hpp>
 
 #include "mlbase.h"
+#include "csrmatrix.h"
 
 using cv::Mat;
 using std::vector;
@@ -12,8 +13,9 @@ using std::vector;
 class Fisher : public MLBase 
 {
 public:
+	//Every row of c1 and c2 is a sample of the class
 	Fisher(Mat & c1, Mat & c2) try :
-		class1(c1.t()), class2(c2.t())
+		class1(c1), class2(c2)
 	{
 		if (c1.cols != c2.cols)
 			throw std::exception("Invalid input matrix!");
@@ -30,17 +32,54 @@ public:
 		std::cout << e.what() << std::endl;
 	}
 
+	//Every row of c1 and c2 is a sparse sample of the class
+	Fisher(const CsrMatrix & c1, const CsrMatrix & c2) try :
+		sparse1(c1), sparse2(c2)
+	{
+		if (c1.cols() != c2.cols())
+			throw std::exception("Invalid input matrix!");
+
+		Sw = Mat::zeros(c1.cols(), c1.cols(), CV_64FC1);
+		parameters = Mat::zeros(c1.cols(), 1, CV_64FC1);
+		threshold = Mat::zeros(c1.cols(), 1, CV_64FC1);
+		mean1 = Mat::zeros(c1.cols(), 1, CV_64FC1);
+		mean2 = Mat::zeros(c1.cols(), 1, CV_64FC1);
+
+		w0 = 0.0;
+	}
+	catch (std::exception & e) {
+		std::cout << e.what() << std::endl;
+	}
+
 	void train() override;
-	int predict(Mat & data);
+	int predict(const Mat & data) const;
+	vector<int> predictBatch(const Mat & datas) const;
+	Mat score(const Mat & datas) const;
+	vector<int> predictBatch(const CsrMatrix & datas) const;
+	Mat score(const CsrMatrix & datas) const;
 	vector<double> showParameters();
 
+	//Fisher is solved in closed form, so there are no iterations to record
+	vector<double> & showErrors() override { return errors; }
+	const vector<double> & showErrors() const override { return errors; }
+	vector<double> & showLossFuncVals() override { return errors; }
+	const vector<double> & showLossFuncVals() const override { return errors; }
+
 private:
 	Mat class1;
 	Mat class2;
+	CsrMatrix sparse1;
+	CsrMatrix sparse2;
 	Mat mean1;
 	Mat mean2;
 	Mat Sw;
 	Mat parameters;
 	Mat threshold;
 	double w0;
+	vector<double> errors;
+
+	bool isSparse() const { return !sparse1.empty(); }
+	void calculateSparseStatistics();
+	Mat calculateScatter(const Mat & datas, Mat & mean);
+	Mat calculateSparseScatter(const CsrMatrix & datas, Mat & mean);
 };
@@ -1,65 +1,144 @@
 #include "gmm.h"
 
-GMM::GMM(Mat & data, int kinds, int i, double e)
+//Digamma function: the recurrence moves x above 6, where the asymptotic
+//series is accurate to about 1e-11
+static double digamma(double x)
+{
+	double result = 0.0;
+	while (x < 6.0)
+	{
+		result -= 1.0 / x;
+		x += 1.0;
+	}
+
+	double f = 1.0 / (x * x);
+	double series = f * (1.0 / 12 - f * (1.0 / 120 - f * (1.0 / 252 -
+		f * (1.0 / 240 - f / 132))));
+	return result + std::log(x) - 0.5 / x - series;
+}
+
+GMM::GMM(Mat & data, int kinds, int i, double e, unsigned int s)
 try : 
-	dataSet(data), K(kinds), iters(i), elipson(e)
+	dataSet(data), K(kinds), requestedK(kinds), iters(i), elipson(e), seed(s)
 {
 	if (kinds <= 1 || i <= 1 || e <= 0.0 ||
 		dataSet.cols < 1 || dataSet.rows < 1)
 		throw std::exception("Invalid parameters!");
 
+	allocate();
+}
+catch (const std::exception& ex)
+{
+	cout << ex.what() << endl;
+}
+
+//A restart of rhs: same data and settings, initialized with another seed
+GMM::GMM(const GMM & rhs, unsigned int s) :
+	dataSet(rhs.dataSet), K(rhs.K), requestedK(rhs.requestedK), iters(rhs.iters),
+	elipson(rhs.elipson), seed(s)
+{
+	executor = rhs.executor;
+	alpha0 = rhs.alpha0;
+	minWeight = rhs.minWeight;
+	weights = rhs.weights;
+	allocate();
+	initParameters();
+}
+
+void GMM::allocate()
+{
 	curLoss = preLoss = 0.0;
 	N = dataSet.rows;
+	totalWeight = weights.empty() ? N : cv::sum(weights).val[0];
 	Nk = Mat::zeros(1, K, CV_64FC1);
 	PIk = Mat::zeros(1, K, CV_64FC1);
 	Uk = Mat::zeros(K, dataSet.cols, CV_64FC1);
-	detK = Mat::zeros(K, dataSet.cols, CV_64FC1);
+	detK = Mat::zeros(1, K, CV_64FC1);
 	gammaZnk = Mat::zeros(dataSet.rows, K, CV_64FC1);
 	sumZnk = Mat::zeros(dataSet.rows, 1, CV_64FC1);
+	InvCovK.resize(K);
 	for (auto & ele : InvCovK)
 		ele = Mat::zeros(dataSet.cols, dataSet.cols, CV_64FC1);
-
-	initParameters();
 }
-catch (const std::exception& e)
+
+//A resumed run continues the EM run stored in the checkpoint, the restarts
+//are only used when training from the initial parameters. The checkpoints
+//of a coreset run are written by its full-data refinement
+void GMM::train()
 {
-	cout << e.what() << endl;
+	telemetry.beginTraining();
+	int start = firstIteration();
+	if (start == 0 && coresetMode())
+		trainCoreset();
+	else
+	{
+		if (!initialized)
+			initParameters();
+		if (start == 0 && restarts > 1)
+			trainRestarts();
+		else
+			iterate(start, coresetMode() ? refineIters : iters, true);
+	}
+
+	finishTraining();
+	telemetry.endTraining();
 }
 
-void GMM::train()
+//One EM run, without hooks it neither validates nor writes checkpoints
+void GMM::iterate(int start, int last, bool hooks)
 {
-	preLoss = calculateLossFunc();
-	errors.push_back(preLoss);
+	if (start == 0)
+	{
+		preLoss = calculateLossFunc();
+		errors.push_back(preLoss);
+	}
 
-	for (int i = 0; i < iters; i++)
+	for (int i = start; i < last; i++)
 	{
 		//M-step of GMM
-		updateNk();
-		updatePIK();
-		updateMeans();
-		updateCovMatrix();
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::MSTEP);
+			updateNk();
+			updatePIK();
+			updateMeans();
+			updateCovMatrix();
+			if (alpha0 > 0.0)
+				pruneComponents();
+		}
 
 		//E-step of GMM
-		updateGammaZnk();
-		updateSumZnk();
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::ESTEP);
+			updateGammaZnk();
+		}
 		
 		//Calculate loss function
-		curLoss = calculateLossFunc();
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::EVALUATE);
+			curLoss = calculateLossFunc();
+		}
 		errors.push_back(curLoss);
+		telemetry.endIteration(curLoss, N);
 		double ratio = std::abs((curLoss - preLoss) / preLoss);
-		if (ratio < elipson)
+		preLoss = curLoss;
+		if ((hooks && !continueTraining(i)) || ratio < elipson)
 			break;
-		else
-			preLoss = curLoss;
 	}
 }
 
 int GMM::predict(Mat & dataPoint)
 {
+	if (!initialized)
+		throw std::exception("The model is not trained!");
+
+	Scratch::Frame frame;
+	Mat diff = frame.take(1, dataSet.cols);
+	Mat leftMul = frame.take(1, dataSet.cols);
+
 	map<double, int, more<double>> maxProb;
 	for (int k = 0; k < K; k++)
 	{
-		double curProb = multiValGaussDist(dataPoint, k);
+		double curProb = multiValGaussDist(dataPoint, k, diff, leftMul);
 		maxProb.insert(std::make_pair(curProb, k));
 	}
 
@@ -69,43 +148,277 @@ int GMM::predict(Mat & dataPoint)
 	return kind++;
 }
 
+//The runs share the read-only data set. Run 0 continues this model, the
+//others start from their own Kmeans initialization. All the runs are
+//built before any of them iterates, since run 0 prunes K of this model
+void GMM::trainRestarts()
+{
+	vector<std::unique_ptr<GMM>> runs(restarts);
+	vector<double> likelihoods(restarts, -DBL_MAX);
+	executor->parallelFor(1, restarts, [&](int first, int last)
+	{
+		for (int r = first; r < last; r++)
+			runs[r].reset(new GMM(*this, seed + r));
+	});
+
+	executor->parallelFor(0, restarts, [&](int first, int last)
+	{
+		for (int r = first; r < last; r++)
+		{
+			if (stopRequested())
+				continue;
+
+			GMM * run = r > 0 ? runs[r].get() : this;
+			run->iterate(0, iters, false);
+			likelihoods[r] = run->calculateLossFunc();
+		}
+	});
+
+	auto bestRun = std::max_element(likelihoods.begin(), likelihoods.end());
+	int best = static_cast<int>(bestRun - likelihoods.begin());
+	if (best > 0)
+	{
+		GMM & run = *runs[best];
+		K = run.K;
+		Nk = run.Nk;
+		PIk = run.PIk;
+		Uk = run.Uk;
+		InvCovK = run.InvCovK;
+		detK = run.detK;
+		gammaZnk = run.gammaZnk;
+		sumZnk = run.sumZnk;
+		curLoss = run.curLoss;
+		preLoss = run.preLoss;
+		errors = run.errors;
+	}
+}
+
+//The parameters are initialized and the restarts run on the coreset, the
+//only passes over the full data set are the O(N*K) seeding and the
+//refinement. The responsibilities carry the sample weights, so the M-step
+//is the one of the full data set
+void GMM::trainCoreset()
+{
+	Mat fullData = dataSet;
+	Mat points;
+	sampleCoreset(coresetSize, points, weights);
+	dataSet = points;
+	allocate();
+	initParameters();
+	if (restarts > 1)
+		trainRestarts();
+	else
+		iterate(0, iters, false);
+
+	//Refining the coreset parameters on all the samples
+	dataSet = fullData;
+	weights.release();
+	N = dataSet.rows;
+	totalWeight = N;
+	gammaZnk = Mat::zeros(N, K, CV_64FC1);
+	sumZnk = Mat::zeros(N, 1, CV_64FC1);
+	updateGammaZnk();
+	if (!stopRequested())
+		iterate(0, refineIters, true);
+}
+
+//Sensitivity sampling for the k-means cost of the k-means++ seeds:
+//s(x) = a*d(x)/c + 2a*cost(B)/(|B|*c) + 4N/|B|, with B the cluster of x,
+//c the mean cost and a = 16(ln K + 2). Far samples and samples of small
+//clusters are drawn more often, and a sample drawn with probability q is
+//weighted by 1/(m*q), so weighted sums over the coreset estimate the sums
+//over the data set without bias
+void GMM::sampleCoreset(int m, Mat & points, Mat & w) const
+{
+	std::default_random_engine e(seed);
+	vector<int> nearest;
+	vector<double> dists;
+	seedMeans(e, nearest, dists);
+
+	vector<double> clusterCost(K, 0.0);
+	vector<double> clusterSize(K, 0.0);
+	double total = 0.0;
+	for (int n = 0; n < N; n++)
+	{
+		clusterCost[nearest[n]] += dists[n];
+		clusterSize[nearest[n]] += 1.0;
+		total += dists[n];
+	}
+
+	double alpha = 16.0 * (std::log(static_cast<double>(K)) + 2.0);
+	double meanCost = std::max(total / N, DBL_MIN);
+	vector<double> sensitivities(N);
+	double sumOfSens = 0.0;
+	for (int n = 0; n < N; n++)
+	{
+		int c = nearest[n];
+		sensitivities[n] = alpha * dists[n] / meanCost +
+			2.0 * alpha * clusterCost[c] / (clusterSize[c] * meanCost) +
+			4.0 * N / clusterSize[c];
+		sumOfSens += sensitivities[n];
+	}
+
+	std::discrete_distribution<int> draw(sensitivities.begin(), sensitivities.end());
+	points.create(m, dataSet.cols, CV_64FC1);
+	w.create(m, 1, CV_64FC1);
+	for (int i = 0; i < m; i++)
+	{
+		int n = draw(e);
+		Mat row = points.row(i);
+		dataSet.row(n).copyTo(row);
+		w.at<double>(i, 0) = sumOfSens / (m * sensitivities[n]);
+	}
+}
+
+//k-means++ seeding: every seed is drawn with a probability proportional to
+//the squared distance to the nearest seed so far. The pass that updates
+//those distances also records the nearest seed of every sample, which is
+//all the sensitivities need
+void GMM::seedMeans(std::default_random_engine & e, vector<int> & nearest,
+	vector<double> & dists) const
+{
+	nearest.assign(N, 0);
+	dists.assign(N, DBL_MAX);
+	int chosen = std::uniform_int_distribution<int>(0, N - 1)(e);
+	for (int k = 0; k < K; k++)
+	{
+		if (k > 0)
+		{
+			//Every sample already coincides with a seed
+			if (std::accumulate(dists.begin(), dists.end(), 0.0) <= 0.0)
+				break;
+			std::discrete_distribution<int> draw(dists.begin(), dists.end());
+			chosen = draw(e);
+		}
+
+		Mat seedPoint = dataSet.row(chosen);
+		executor->parallelFor(0, N, [&](int first, int last)
+		{
+			for (int n = first; n < last; n++)
+			{
+				double d = cv::norm(dataSet.row(n), seedPoint, cv::NORM_L2SQR);
+				if (d < dists[n])
+				{
+					dists[n] = d;
+					nearest[n] = k;
+				}
+			}
+		}, 256);
+	}
+}
+
+//The checkpoint holds the parameters together with the responsibilities,
+//so a resumed run continues with the M-step it would have done next
+void GMM::saveState(cv::FileStorage & fs) const
+{
+	fs << "Nk" << Nk;
+	fs << "PIk" << PIk;
+	fs << "Uk" << Uk;
+	fs << "InvCovK" << InvCovK;
+	fs << "detK" << detK;
+	fs << "gammaZnk" << gammaZnk;
+	fs << "sumZnk" << sumZnk;
+	fs << "preLoss" << preLoss;
+	fs << "errors" << errors;
+}
+
+void GMM::loadState(const cv::FileNode & node)
+{
+	Mat means, gamma, nk, pik, det, sums;
+	vector<Mat> invCovs;
+	node["Uk"] >> means;
+	node["gammaZnk"] >> gamma;
+	node["InvCovK"] >> invCovs;
+	node["Nk"] >> nk;
+	node["PIk"] >> pik;
+	node["detK"] >> det;
+	node["sumZnk"] >> sums;
+	//A variational model prunes its components, the state may have been
+	//saved before a later prune, so it may hold more components than the
+	//model has now but never more than it was built with
+	int kept = means.rows;
+	if (kept < 1 || kept > requestedK || means.cols != dataSet.cols ||
+		gamma.rows != N || gamma.cols != kept ||
+		static_cast<int>(invCovs.size()) != kept ||
+		nk.cols != kept || pik.cols != kept || det.cols != kept || sums.rows != N)
+		throw std::exception("The checkpoint does not match the model!");
+
+	K = kept;
+	initialized = true;
+	Uk = means;
+	gammaZnk = gamma;
+	InvCovK = invCovs;
+	Nk = nk;
+	PIk = pik;
+	detK = det;
+	sumZnk = sums;
+	node["preLoss"] >> preLoss;
+	node["errors"] >> errors;
+}
+
+//Negative mean log-likelihood of the validation set
+double GMM::validationLoss(const Mat & data, const Mat & targets) const
+{
+	auto partialLoss = [&](int first, int last)
+	{
+		Scratch::Frame frame;
+		Mat diff = frame.take(1, dataSet.cols);
+		Mat leftMul = frame.take(1, dataSet.cols);
+
+		double sum = 0.0;
+		for (int n = first; n < last; n++)
+		{
+			double density = 0.0;
+			for (int k = 0; k < K; k++)
+				density += PIk.at<double>(0, k) *
+					multiValGaussDist(data.row(n), k, diff, leftMul);
+			sum -= std::log(density);
+		}
+
+		return sum;
+	};
+
+	double loss = executor->parallelReduce(0, data.rows, 0.0,
+		partialLoss, std::plus<double>(), 256);
+
+	return loss / data.rows;
+}
+
 void GMM::initParameters()
 {
+	initialized = true;
+
 	//Create a Kmeans class to initialize the parameters Uk and Covk
 	Kmeans k(dataSet, K);
+	k.setSeed(seed);
+	k.setExecutor(*executor);
 	k.train();
 
 	//Initializing Uk
 	k.showMeans().convertTo(Uk, CV_64FC1);
 
-	//Initializing CovK
+	//Initializing CovK, the clusters are independent of each other
 	auto & kinds = k.showKinds();
-	for (int k = 0; k < K; k++)
+	executor->parallelFor(0, K, [&](int first, int last)
 	{
-		auto & kindSet = kinds[k];
-		auto & covMatrix = InvCovK[k];
-		auto & meanK = Uk.row(k);
-		int Nk = kindSet.size();
-		for (auto index : kindSet)
+		for (int c = first; c < last; c++)
 		{
-			Mat diff = dataSet.row(index) - meanK;
-			double * rowPtr = diff.ptr<double>(0);
-			for (int row = 0; row < dataSet.cols; row++)
+			auto & kindSet = kinds[c];
+			Mat covMatrix = Mat::zeros(dataSet.cols, dataSet.cols, CV_64FC1);
+			if (!kindSet.empty())
 			{
-				double * covPtr = covMatrix.ptr<double>(row);
-				double * colPtr = diff.ptr<double>(0);
-				for (int col = 0; col < dataSet.rows; col++)
+				Mat diffs(static_cast<int>(kindSet.size()), dataSet.cols, CV_64FC1);
+				for (int i = 0; i < diffs.rows; i++)
 				{
-					double val = (*rowPtr) * (*colPtr);
-					val = val / Nk;
-					*covPtr += val;
-					colPtr++;
-					covPtr++;
+					Mat diff = diffs.row(i);
+					Mat(dataSet.row(kindSet[i]) - Uk.row(c)).copyTo(diff);
 				}
-				rowPtr++;
+				cv::mulTransposed(diffs, covMatrix, true);
+				covMatrix /= static_cast<double>(kindSet.size());
 			}
+			updateInverse(c, covMatrix);
 		}
-	}
+	});
 
 	//Initializing Nk
 	for (int k = 0; k < K; k++)
@@ -122,51 +435,56 @@ void GMM::initParameters()
 
 	//Initializing Gamma Znk and sum of Znk
 	updateGammaZnk();
-	updateSumZnk();
 }
 
+//Computes the normalized responsibilities and, in sumZnk, the mixture
+//density of every data point. The rows are independent of each other
 void GMM::updateGammaZnk()
 {
-	for (int n = 0; n < dataSet.rows; n++)
+	executor->parallelFor(0, dataSet.rows, [&](int first, int last)
 	{
-		double * gammaPtr = gammaZnk.ptr<double>(n);
-		for (int k = 0; k < K; k++)
+		Scratch::Frame frame;
+		Mat diff = frame.take(1, dataSet.cols);
+		Mat leftMul = frame.take(1, dataSet.cols);
+
+		for (int n = first; n < last; n++)
 		{
-			double piK = PIk.at<double>(0, k);
-			*gammaPtr = piK * multiValGaussDist(dataSet.row(n), k);
-			gammaPtr++;
-		}
-	}
-}
+			double * gammaPtr = gammaZnk.ptr<double>(n);
+			double sum = 0.0;
+			for (int k = 0; k < K; k++)
+			{
+				double piK = PIk.at<double>(0, k);
+				gammaPtr[k] = piK * multiValGaussDist(dataSet.row(n), k, diff, leftMul);
+				sum += gammaPtr[k];
+			}
 
-void GMM::updateSumZnk()
-{
-	double * sumPtr = sumZnk.ptr<double>(0);
-	for (int n = 0; n < sumZnk.cols; n++)
-	{
-		Mat rowGamma = gammaZnk.row(n);
-		auto sum = cv::sum(rowGamma);
-		*sumPtr = sum.val[0];
-	}
+			//Coreset samples carry their weights in the responsibilities
+			sumZnk.at<double>(n, 0) = sum;
+			double norm = weights.empty() ? sum : sum / weights.at<double>(n, 0);
+			for (int k = 0; sum > 0.0 && k < K; k++)
+				gammaPtr[k] /= norm;
+		}
+	}, 256);
 }
 
-
-double GMM::multiValGaussDist(Mat & dataPoint, int k)
+//diff and leftMul are 1*D buffers of the caller, so evaluating the
+//density does not allocate
+double GMM::multiValGaussDist(const Mat & dataPoint, int k,
+	Mat & diff, Mat & leftMul) const
 {
 	if (k < 0)
 		throw std::exception("Invalid input!");
 
-	double pik = PIk.at<double>(0, k);
 	Mat meanK = Uk.row(k);
 	double det = detK.at<double>(0, k);
-	Mat invK = InvCovK[k];
+	const Mat & invK = InvCovK[k];
 
-	double part1 = std::pow(2 * 3.1415, dataSet.cols / 2);
+	double part1 = std::pow(2 * 3.1415, dataSet.cols / 2.0);
 	double part2 = std::sqrt(det);
 	double left = 1/(part1*part2);
 
-	Mat diff = dataPoint - meanK;
-	Mat leftMul = diff*invK;
+	cv::subtract(dataPoint, meanK, diff);
+	cv::gemm(diff, invK, 1.0, cv::noArray(), 0.0, leftMul);
 	double part3 = -0.5 * diff.dot(leftMul);
 	double right = std::exp(part3);
 	double rst = left * right;
@@ -177,98 +495,147 @@ double GMM::multiValGaussDist(Mat & dataPoint, int k)
 double GMM::calculateLossFunc()
 {
 	double rst = 0.0;
-	for (int n = 0; n < sumZnk.cols; n++)
+	for (int n = 0; n < sumZnk.rows; n++)
 	{
-		double sumZn = sumZnk.at<double>(0, n);
+		double sumZn = sumZnk.at<double>(n, 0);
 		double tmpLn = std::log(sumZn);
+		if (!weights.empty())
+			tmpLn *= weights.at<double>(n, 0);
 		rst += tmpLn;
 	}
 
 	return rst;
 }
 
+//Every covariance matrix is one weighted GEMM over the centered data,
+//the components are computed in parallel
 void GMM::updateCovMatrix()
 {
-	for (int k = 0; k < K; k++)
-	{
-		InvCovK[k] = Mat::zeros(
-					 InvCovK[k].rows, 
-					 InvCovK[k].cols, 
-					 CV_64FC1);
-	}
-
-	for (int n = 0; n < dataSet.rows; n++)
+	//The weighted deviations are built one block of rows at a time and the
+	//D*D products of the blocks are summed, so a worker holds blockRows*D
+	//doubles rather than a copy of the data set
+	executor->parallelFor(0, K, [&](int first, int last)
 	{
-		auto & curData = dataSet.row(n);
-		double sZnk = sumZnk.at<double>(0, n);
-		for (int k = 0; k < K; k++)
+		Scratch::Frame frame;
+		Mat buffer = frame.take(std::min(dataSet.rows, Scratch::blockRows), dataSet.cols);
+		Mat blockCov = frame.take(dataSet.cols, dataSet.cols);
+		for (int k = first; k < last; k++)
 		{
-			double nk = Nk.at<double>(0, k);
-			double Znk = gammaZnk.at<double>(n, k);
-			auto & covMatrix = InvCovK[k];
-			Mat diff = curData - Uk.row(k);
-			double * diffRow = diff.ptr<double>(0);
-			for (int row = 0; row < dataSet.rows; row++)
+			Mat covMatrix = Mat::zeros(dataSet.cols, dataSet.cols, CV_64FC1);
+			for (int begin = 0; begin < dataSet.rows; begin += Scratch::blockRows)
 			{
-				double * rowPtr = covMatrix.ptr<double>(row);
-				double * diffCol = diff.ptr<double>(0);
-				for (int col = 0; col < dataSet.cols; col++)
+				int end = std::min(begin + Scratch::blockRows, dataSet.rows);
+				Mat weighted = buffer.rowRange(0, end - begin);
+				for (int n = begin; n < end; n++)
 				{
-					double gZnk = Znk / sZnk;
-					double val = gZnk * (*diffRow) * (*diffCol);
-					*rowPtr += val / nk;
-					diffCol++;
-					rowPtr++;
+					double scale = std::sqrt(gammaZnk.at<double>(n, k));
+					const double * dataPtr = dataSet.ptr<double>(n);
+					const double * meanPtr = Uk.ptr<double>(k);
+					double * rowPtr = weighted.ptr<double>(n - begin);
+					for (int d = 0; d < dataSet.cols; d++)
+						*rowPtr++ = scale * (*dataPtr++ - *meanPtr++);
 				}
-				diffRow++;
+
+				cv::mulTransposed(weighted, blockCov, true);
+				covMatrix += blockCov;
 			}
+			covMatrix /= std::max(Nk.at<double>(0, k), 1e-10);
+			updateInverse(k, covMatrix);
 		}
-	}
+	});
+}
 
-	double * detPtr = detK.ptr<double>(0);
-	for (int k = 0; k < K; k++)
-	{
-		auto & covK = InvCovK[k];
-		Mat tmpCov = covK.inv();
-		covK = tmpCov;
-		*detPtr = cv::determinant(tmpCov);
-		detPtr++;
-	}
+//Stores the inverse and the determinant of a covariance matrix, a small
+//ridge keeps collapsed components invertible
+void GMM::updateInverse(int k, Mat & covMatrix)
+{
+	covMatrix += 1e-6 * Mat::eye(covMatrix.rows, covMatrix.cols, CV_64FC1);
+	InvCovK[k] = covMatrix.inv(cv::DECOMP_CHOLESKY);
+	detK.at<double>(0, k) = cv::determinant(covMatrix);
 }
 
 void GMM::updateMeans()
 {
-	Uk = Uk.zeros(Uk.rows, Uk.cols, CV_64FC1);
-	for (int n = 0; n < dataSet.rows; n++)
+	//Uk = gamma' * X / Nk
+	cv::gemm(gammaZnk, dataSet, 1.0, cv::noArray(), 0.0, Uk, cv::GEMM_1_T);
+	for (int k = 0; k < K; k++)
+		Uk.row(k) /= std::max(Nk.at<double>(0, k), 1e-10);
+}
+
+void GMM::updateNk()
+{
+	cv::reduce(gammaZnk, Nk, 0, cv::REDUCE_SUM);
+}
+
+//With a Dirichlet prior the E-step weights the components by
+//exp(E[ln PIk]) = exp(digamma(a0 + Nk) - digamma(K*a0 + N)), which does
+//not sum to one and drains the components with few samples
+void GMM::updatePIK()
+{
+	PIk = PIk.zeros(PIk.rows, PIk.cols, CV_64FC1);
+	if (alpha0 > 0.0)
 	{
-		Mat curData = dataSet.row(n);
+		double total = digamma(K * alpha0 + cv::sum(Nk).val[0]);
 		for (int k = 0; k < K; k++)
 		{
-			double gammaPtr = gammaZnk.at<double>(n,k);
-			double nk = Nk.at<double>(0, k);
-			Mat & mean = Uk.row(k);
-			mean += (gammaPtr/nk) * curData;
+			double expectLog = digamma(alpha0 + Nk.at<double>(0, k)) - total;
+			PIk.at<double>(0, k) = std::exp(expectLog);
 		}
+		return;
 	}
-}
 
-void GMM::updateNk()
-{
-	Nk = Nk.zeros(Nk.rows, Nk.cols, CV_64FC1);
 	for (int k = 0; k < K; k++)
 	{
-		Mat tmp = gammaZnk.col(k).t();
-		auto sum = cv::sum(tmp);
-		Nk.at<double>(0, k) = sum.val[0];
+		PIk.at<double>(0, k) = Nk.at<double>(0, k) / totalWeight;
 	}
 }
 
-void GMM::updatePIK()
+//Removing the components with less than minWeight of the samples, the
+//largest one is always kept. The responsibilities are rebuilt by the
+//E-step that follows the M-step
+void GMM::pruneComponents()
 {
-	PIk = PIk.zeros(PIk.rows, PIk.cols, CV_64FC1);
+	vector<int> keep;
 	for (int k = 0; k < K; k++)
 	{
-		PIk.at<double>(0, k) = Nk.at<double>(0, k) / N;
+		if (Nk.at<double>(0, k) >= minWeight * totalWeight)
+			keep.push_back(k);
+	}
+	if (keep.empty())
+	{
+		int largest = 0;
+		for (int k = 1; k < K; k++)
+		{
+			if (Nk.at<double>(0, k) > Nk.at<double>(0, largest))
+				largest = k;
+		}
+		keep.push_back(largest);
 	}
+	if (static_cast<int>(keep.size()) == K)
+		return;
+
+	int kept = static_cast<int>(keep.size());
+	Mat nk(1, kept, CV_64FC1);
+	Mat uk(kept, dataSet.cols, CV_64FC1);
+	Mat det(1, kept, CV_64FC1);
+	vector<Mat> invCovs(kept);
+	for (int j = 0; j < kept; j++)
+	{
+		int k = keep[j];
+		nk.at<double>(0, j) = Nk.at<double>(0, k);
+		Mat row = uk.row(j);
+		Uk.row(k).copyTo(row);
+		det.at<double>(0, j) = detK.at<double>(0, k);
+		invCovs[j] = InvCovK[k];
+	}
+
+	K = kept;
+	Nk = nk;
+	Uk = uk;
+	detK = det;
+	InvCovK.swap(invCovs);
+	PIk = Mat::zeros(1, K, CV_64FC1);
+	gammaZnk = Mat::zeros(N, K, CV_64FC1);
+	updatePIK();
 }
 
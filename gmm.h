@@ -4,10 +4,14 @@
 #include <map>
 #include <algorithm>
 #include <iostream>
+#include <memory>
+#include <cfloat>
+#include <numeric>
 #include <opencv2\core.hpp>
 
 #include "kmeans.h"
 #include "mlbase.h"
+#include "scratch.h"
 
 using std::cout;
 using std::endl;
@@ -19,7 +23,8 @@ using cv::Mat;
 template <typename T>
 class more
 {
-	bool operator() (const T & t1, const T & t2)
+public:
+	bool operator() (const T & t1, const T & t2) const
 	{
 		return t1 > t2;
 	}
@@ -29,25 +34,68 @@ class more
 class GMM : public MLBase
 {
 public:
-	GMM(Mat & data, int kinds, int i = 100, double e = 0.01);
+	//s seeds the Kmeans that initializes the parameters. The parameters are
+	//initialized by the first train(), on the coreset in coreset mode
+	GMM(Mat & data, int kinds, int i = 100, double e = 0.01,
+		unsigned int s = std::default_random_engine::default_seed);
 	GMM(const GMM &) = delete;
 
 	void train() override;
+	//Number of EM runs, run in parallel on the executor. The run with the
+	//largest log-likelihood is kept, run r is initialized with seed + r
+	void setRestarts(int n)
+	{
+		if (n >= 1)
+			restarts = n;
+	}
+	//Variational Bayesian mixture weights under a symmetric Dirichlet prior
+	//a0, small values drive the weights of unused components to zero. The
+	//components whose share of the samples falls under pruneWeight are
+	//removed, so K shrinks during training. a0 <= 0 means plain EM
+	void setDirichletPrior(double a0, double pruneWeight = 1e-3)
+	{
+		alpha0 = a0;
+		minWeight = pruneWeight;
+	}
+	//EM on a weighted coreset of m samples drawn around k-means++ seeds,
+	//until it converges, followed by a few EM iterations on the full data
+	//set. Kmeans only runs on the coreset. m <= 0 or m >= N trains on the
+	//full data set
+	void setCoreset(int m, int refinements = 2)
+	{
+		coresetSize = m;
+		if (refinements >= 0)
+			refineIters = refinements;
+	}
+	int numOfComponents() const { return K; }
+	//Throws before the parameters are initialized by train() or resume()
 	int predict(Mat & dataPoint);
 	const vector<double> & showLossFuncVals() const override {
 		return errors;
 	}
 	vector<double> & showLossFuncVals() override { return errors; }
+	const vector<double> & showErrors() const override { return errors; }
+	vector<double> & showErrors() override { return errors; }
 	const Mat & showMeans() const { return Uk; }
 	Mat & showMeans() { return Uk; }
 
 private:
 	int N;
 	int K;
+	//K before any pruning, the bound of the components a checkpoint may hold
+	int requestedK;
 	double elipson;
 	int iters;
 	double curLoss;
 	double preLoss;
+	unsigned int seed;
+	int restarts = 1;
+	double alpha0 = 0.0;
+	double minWeight = 1e-3;
+	int coresetSize = 0;
+	int refineIters = 2;
+	double totalWeight;
+	bool initialized = false;
 
 	Mat Nk;
 	Mat PIk;
@@ -57,15 +105,30 @@ private:
 	Mat gammaZnk;
 	Mat sumZnk;
 	Mat dataSet;
+	Mat weights;
 	vector<double> errors;
 
+	GMM(const GMM & rhs, unsigned int s);
+	void allocate();
+	bool coresetMode() const { return coresetSize > 0 && coresetSize < N; }
+	void iterate(int start, int last, bool hooks);
+	void trainRestarts();
+	void trainCoreset();
+	void sampleCoreset(int m, Mat & points, Mat & w) const;
+	void seedMeans(std::default_random_engine & e, vector<int> & nearest,
+		vector<double> & dists) const;
+	void saveState(cv::FileStorage & fs) const override;
+	void loadState(const cv::FileNode & node) override;
+	double validationLoss(const Mat & data, const Mat & targets) const override;
 	void initParameters();
 	void updateGammaZnk();
-	void updateSumZnk();
 	void updateCovMatrix();
+	void updateInverse(int k, Mat & covMatrix);
 	void updateMeans();
 	void updateNk();
 	void updatePIK();
-	double multiValGaussDist(Mat & dataPoint, int k);
+	void pruneComponents();
+	double multiValGaussDist(const Mat & dataPoint, int k,
+		Mat & diff, Mat & leftMul) const;
 	double calculateLossFunc();
 };
@@ -0,0 +1,543 @@
+#include "kernels.h"
+
+namespace
+{
+	const double PI = 3.14159265358979323846;
+
+	//P*Q squared distances |a_i|^2 + |b_j|^2 - 2 a_i'b_j, the GEMM does the
+	//work and the rounding errors are clipped at zero
+	void squaredDistances(const Mat & a, const Mat & b, Mat & r2)
+	{
+		Mat normA, normB;
+		cv::reduce(a.mul(a), normA, 1, cv::REDUCE_SUM);
+		cv::reduce(b.mul(b), normB, 1, cv::REDUCE_SUM);
+		cv::gemm(a, b, -2.0, cv::noArray(), 0.0, r2, cv::GEMM_2_T);
+
+		const double * bPtr = normB.ptr<double>(0);
+		for (int i = 0; i < r2.rows; i++)
+		{
+			double * rPtr = r2.ptr<double>(i);
+			double na = normA.at<double>(i, 0);
+			for (int j = 0; j < r2.cols; j++)
+				rPtr[j] = std::max(rPtr[j] + na + bPtr[j], 0.0);
+		}
+	}
+
+	//The distances of a sample to itself are exactly zero
+	void squaredDistances(const Mat & x, Mat & r2)
+	{
+		squaredDistances(x, x, r2);
+		for (int i = 0; i < r2.rows; i++)
+			r2.at<double>(i, i) = 0.0;
+	}
+}
+
+vector<double> Kernel::getParameters() const
+{
+	vector<double> p(numOfParameters());
+	if (!p.empty())
+		readParameters(&p[0]);
+
+	return p;
+}
+
+void Kernel::setParameters(const vector<double> & p)
+{
+	if (static_cast<int>(p.size()) != numOfParameters())
+		throw std::exception("Invalid number of parameters!");
+
+	if (!p.empty())
+		writeParameters(&p[0]);
+}
+
+StationaryKernel::StationaryKernel(double variance, const vector<double> & lengthscales) :
+	logVariance(std::log(variance))
+{
+	if (variance <= 0.0 || lengthscales.empty())
+		throw std::exception("Invalid parameters!");
+
+	for (auto ele : lengthscales)
+	{
+		if (ele <= 0.0)
+			throw std::exception("Invalid parameters!");
+		logLengths.push_back(std::log(ele));
+	}
+}
+
+int StationaryKernel::numOfParameters() const
+{
+	return 1 + static_cast<int>(logLengths.size() + logShapes.size());
+}
+
+void StationaryKernel::readParameters(double * p) const
+{
+	*p++ = logVariance;
+	for (auto ele : logLengths)
+		*p++ = ele;
+	for (auto ele : logShapes)
+		*p++ = ele;
+}
+
+void StationaryKernel::writeParameters(const double * p)
+{
+	logVariance = *p++;
+	for (auto & ele : logLengths)
+		ele = *p++;
+	for (auto & ele : logShapes)
+		ele = *p++;
+}
+
+//Dividing the features by their lengthscales turns the scaled distances
+//into plain euclidean ones
+Mat StationaryKernel::scaleRows(const Mat & a) const
+{
+	if (logLengths.size() != 1 && static_cast<int>(logLengths.size()) != a.cols)
+		throw std::exception("The lengthscales do not match the data!");
+
+	vector<double> inv(a.cols);
+	for (int d = 0; d < a.cols; d++)
+		inv[d] = std::exp(-logLengths[logLengths.size() == 1 ? 0 : d]);
+
+	Mat scaled(a.rows, a.cols, CV_64FC1);
+	for (int i = 0; i < a.rows; i++)
+	{
+		const double * aPtr = a.ptr<double>(i);
+		double * sPtr = scaled.ptr<double>(i);
+		for (int d = 0; d < a.cols; d++)
+			sPtr[d] = aPtr[d] * inv[d];
+	}
+
+	return scaled;
+}
+
+void StationaryKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	Mat r2;
+	squaredDistances(scaleRows(a), scaleRows(b), r2);
+	profile(r2, std::exp(logVariance), k, nullptr);
+}
+
+//dk/dlog(s2) = k and dk/dlog(l_d) = g * (a_d - b_d)^2 / l_d^2, which is
+//g * r2 for an isotropic kernel
+void StationaryKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	Mat scaled = scaleRows(x);
+	Mat r2;
+	squaredDistances(scaled, r2);
+	if (!grads)
+	{
+		profile(r2, std::exp(logVariance), k, nullptr);
+		return;
+	}
+
+	Mat g;
+	profile(r2, std::exp(logVariance), k, &g);
+	grads->push_back(k.clone());
+	if (logLengths.size() == 1)
+		grads->push_back(g.mul(r2));
+	else
+	{
+		for (int d = 0; d < x.cols; d++)
+		{
+			Mat grad(x.rows, x.rows, CV_64FC1);
+			for (int i = 0; i < x.rows; i++)
+			{
+				double xi = scaled.at<double>(i, d);
+				const double * gPtr = g.ptr<double>(i);
+				double * gradPtr = grad.ptr<double>(i);
+				for (int j = 0; j < x.rows; j++)
+				{
+					double diff = xi - scaled.at<double>(j, d);
+					gradPtr[j] = gPtr[j] * diff * diff;
+				}
+			}
+			grads->push_back(grad);
+		}
+	}
+	shapeGradients(r2, k, *grads);
+}
+
+void StationaryKernel::diagonal(const Mat & a, Mat & d) const
+{
+	d.create(a.rows, 1, CV_64FC1);
+	d.setTo(std::exp(logVariance));
+}
+
+void RBFKernel::profile(const Mat & r2, double variance, Mat & k, Mat * g) const
+{
+	k.create(r2.rows, r2.cols, CV_64FC1);
+	if (g)
+		g->create(r2.rows, r2.cols, CV_64FC1);
+
+	for (int i = 0; i < r2.rows; i++)
+	{
+		const double * rPtr = r2.ptr<double>(i);
+		double * kPtr = k.ptr<double>(i);
+		double * gPtr = g ? g->ptr<double>(i) : nullptr;
+		for (int j = 0; j < r2.cols; j++)
+		{
+			kPtr[j] = variance * std::exp(-0.5 * rPtr[j]);
+			if (gPtr)
+				gPtr[j] = kPtr[j];
+		}
+	}
+}
+
+void Matern32Kernel::profile(const Mat & r2, double variance, Mat & k, Mat * g) const
+{
+	const double sqrt3 = std::sqrt(3.0);
+	k.create(r2.rows, r2.cols, CV_64FC1);
+	if (g)
+		g->create(r2.rows, r2.cols, CV_64FC1);
+
+	for (int i = 0; i < r2.rows; i++)
+	{
+		const double * rPtr = r2.ptr<double>(i);
+		double * kPtr = k.ptr<double>(i);
+		double * gPtr = g ? g->ptr<double>(i) : nullptr;
+		for (int j = 0; j < r2.cols; j++)
+		{
+			double r = std::sqrt(rPtr[j]);
+			double e = variance * std::exp(-sqrt3 * r);
+			kPtr[j] = (1.0 + sqrt3 * r) * e;
+			if (gPtr)
+				gPtr[j] = 3.0 * e;
+		}
+	}
+}
+
+void Matern52Kernel::profile(const Mat & r2, double variance, Mat & k, Mat * g) const
+{
+	const double sqrt5 = std::sqrt(5.0);
+	k.create(r2.rows, r2.cols, CV_64FC1);
+	if (g)
+		g->create(r2.rows, r2.cols, CV_64FC1);
+
+	for (int i = 0; i < r2.rows; i++)
+	{
+		const double * rPtr = r2.ptr<double>(i);
+		double * kPtr = k.ptr<double>(i);
+		double * gPtr = g ? g->ptr<double>(i) : nullptr;
+		for (int j = 0; j < r2.cols; j++)
+		{
+			double r = std::sqrt(rPtr[j]);
+			double e = variance * std::exp(-sqrt5 * r);
+			kPtr[j] = (1.0 + sqrt5 * r + 5.0 / 3.0 * rPtr[j]) * e;
+			if (gPtr)
+				gPtr[j] = 5.0 / 3.0 * (1.0 + sqrt5 * r) * e;
+		}
+	}
+}
+
+RationalQuadraticKernel::RationalQuadraticKernel(double variance,
+	double lengthscale, double alpha) :
+	RationalQuadraticKernel(variance, vector<double>(1, lengthscale), alpha)
+{
+}
+
+RationalQuadraticKernel::RationalQuadraticKernel(double variance,
+	const vector<double> & lengthscales, double alpha) :
+	StationaryKernel(variance, lengthscales)
+{
+	if (alpha <= 0.0)
+		throw std::exception("Invalid parameters!");
+
+	logShapes.push_back(std::log(alpha));
+}
+
+//g = s2 * (1 + r2 / (2a))^(-a-1) = k / (1 + r2 / (2a))
+void RationalQuadraticKernel::profile(const Mat & r2, double variance,
+	Mat & k, Mat * g) const
+{
+	double alpha = std::exp(logShapes[0]);
+	k.create(r2.rows, r2.cols, CV_64FC1);
+	if (g)
+		g->create(r2.rows, r2.cols, CV_64FC1);
+
+	for (int i = 0; i < r2.rows; i++)
+	{
+		const double * rPtr = r2.ptr<double>(i);
+		double * kPtr = k.ptr<double>(i);
+		double * gPtr = g ? g->ptr<double>(i) : nullptr;
+		for (int j = 0; j < r2.cols; j++)
+		{
+			double base = 1.0 + rPtr[j] / (2.0 * alpha);
+			kPtr[j] = variance * std::pow(base, -alpha);
+			if (gPtr)
+				gPtr[j] = kPtr[j] / base;
+		}
+	}
+}
+
+//dk/dlog(a) = k * (r2 / (2 * base) - a * ln(base))
+void RationalQuadraticKernel::shapeGradients(const Mat & r2, const Mat & k,
+	vector<Mat> & grads) const
+{
+	double alpha = std::exp(logShapes[0]);
+	Mat grad(r2.rows, r2.cols, CV_64FC1);
+	for (int i = 0; i < r2.rows; i++)
+	{
+		const double * rPtr = r2.ptr<double>(i);
+		const double * kPtr = k.ptr<double>(i);
+		double * gradPtr = grad.ptr<double>(i);
+		for (int j = 0; j < r2.cols; j++)
+		{
+			double base = 1.0 + rPtr[j] / (2.0 * alpha);
+			gradPtr[j] = kPtr[j] * (0.5 * rPtr[j] / base - alpha * std::log(base));
+		}
+	}
+	grads.push_back(grad);
+}
+
+PeriodicKernel::PeriodicKernel(double variance, double lengthscale, double period)
+{
+	if (variance <= 0.0 || lengthscale <= 0.0 || period <= 0.0)
+		throw std::exception("Invalid parameters!");
+
+	logVariance = std::log(variance);
+	logLength = std::log(lengthscale);
+	logPeriod = std::log(period);
+}
+
+void PeriodicKernel::readParameters(double * p) const
+{
+	p[0] = logVariance;
+	p[1] = logLength;
+	p[2] = logPeriod;
+}
+
+void PeriodicKernel::writeParameters(const double * p)
+{
+	logVariance = p[0];
+	logLength = p[1];
+	logPeriod = p[2];
+}
+
+void PeriodicKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	double variance = std::exp(logVariance);
+	double invL2 = std::exp(-2.0 * logLength);
+	double freq = PI * std::exp(-logPeriod);
+
+	squaredDistances(a, b, k);
+	for (int i = 0; i < k.rows; i++)
+	{
+		double * kPtr = k.ptr<double>(i);
+		for (int j = 0; j < k.cols; j++)
+		{
+			double s = std::sin(freq * std::sqrt(kPtr[j]));
+			kPtr[j] = variance * std::exp(-2.0 * s * s * invL2);
+		}
+	}
+}
+
+//With u = pi * d / p and s = sin(u): dk/dlog(l) = 4k * s^2 / l^2 and
+//dk/dlog(p) = 4k * u * s * cos(u) / l^2
+void PeriodicKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	if (!grads)
+	{
+		gram(x, x, k);
+		return;
+	}
+
+	double variance = std::exp(logVariance);
+	double invL2 = std::exp(-2.0 * logLength);
+	double freq = PI * std::exp(-logPeriod);
+
+	Mat r2;
+	squaredDistances(x, r2);
+	k.create(x.rows, x.rows, CV_64FC1);
+	Mat gradL(x.rows, x.rows, CV_64FC1);
+	Mat gradP(x.rows, x.rows, CV_64FC1);
+	for (int i = 0; i < x.rows; i++)
+	{
+		const double * rPtr = r2.ptr<double>(i);
+		double * kPtr = k.ptr<double>(i);
+		double * lPtr = gradL.ptr<double>(i);
+		double * pPtr = gradP.ptr<double>(i);
+		for (int j = 0; j < x.rows; j++)
+		{
+			double u = freq * std::sqrt(rPtr[j]);
+			double s = std::sin(u);
+			kPtr[j] = variance * std::exp(-2.0 * s * s * invL2);
+			lPtr[j] = 4.0 * kPtr[j] * s * s * invL2;
+			pPtr[j] = 4.0 * kPtr[j] * u * s * std::cos(u) * invL2;
+		}
+	}
+
+	grads->push_back(k.clone());
+	grads->push_back(gradL);
+	grads->push_back(gradP);
+}
+
+void PeriodicKernel::diagonal(const Mat & a, Mat & d) const
+{
+	d.create(a.rows, 1, CV_64FC1);
+	d.setTo(std::exp(logVariance));
+}
+
+void LinearKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	cv::gemm(a, b, std::exp(logVariance), cv::noArray(), 0.0, k, cv::GEMM_2_T);
+}
+
+void LinearKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	gram(x, x, k);
+	if (grads)
+		grads->push_back(k.clone());
+}
+
+void LinearKernel::diagonal(const Mat & a, Mat & d) const
+{
+	cv::reduce(a.mul(a), d, 1, cv::REDUCE_SUM);
+	d *= std::exp(logVariance);
+}
+
+void ConstantKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	k.create(a.rows, b.rows, CV_64FC1);
+	k.setTo(std::exp(logValue));
+}
+
+void ConstantKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	gram(x, x, k);
+	if (grads)
+		grads->push_back(k.clone());
+}
+
+void ConstantKernel::diagonal(const Mat & a, Mat & d) const
+{
+	d.create(a.rows, 1, CV_64FC1);
+	d.setTo(std::exp(logValue));
+}
+
+void WhiteKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	k = Mat::zeros(a.rows, b.rows, CV_64FC1);
+}
+
+void WhiteKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	k = std::exp(logNoise) * Mat::eye(x.rows, x.rows, CV_64FC1);
+	if (grads)
+		grads->push_back(k.clone());
+}
+
+void WhiteKernel::diagonal(const Mat & a, Mat & d) const
+{
+	d = Mat::zeros(a.rows, 1, CV_64FC1);
+}
+
+KernelPtr SumKernel::clone() const
+{
+	return std::make_shared<SumKernel>(lhs->clone(), rhs->clone());
+}
+
+int SumKernel::numOfParameters() const
+{
+	return lhs->numOfParameters() + rhs->numOfParameters();
+}
+
+void SumKernel::readParameters(double * p) const
+{
+	lhs->readParameters(p);
+	rhs->readParameters(p + lhs->numOfParameters());
+}
+
+void SumKernel::writeParameters(const double * p)
+{
+	lhs->writeParameters(p);
+	rhs->writeParameters(p + lhs->numOfParameters());
+}
+
+void SumKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	Mat right;
+	lhs->gram(a, b, k);
+	rhs->gram(a, b, right);
+	k += right;
+}
+
+void SumKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	Mat right;
+	lhs->gram(x, k, grads);
+	rhs->gram(x, right, grads);
+	k += right;
+}
+
+void SumKernel::diagonal(const Mat & a, Mat & d) const
+{
+	Mat right;
+	lhs->diagonal(a, d);
+	rhs->diagonal(a, right);
+	d += right;
+}
+
+KernelPtr ProductKernel::clone() const
+{
+	return std::make_shared<ProductKernel>(lhs->clone(), rhs->clone());
+}
+
+int ProductKernel::numOfParameters() const
+{
+	return lhs->numOfParameters() + rhs->numOfParameters();
+}
+
+void ProductKernel::readParameters(double * p) const
+{
+	lhs->readParameters(p);
+	rhs->readParameters(p + lhs->numOfParameters());
+}
+
+void ProductKernel::writeParameters(const double * p)
+{
+	lhs->writeParameters(p);
+	rhs->writeParameters(p + lhs->numOfParameters());
+}
+
+void ProductKernel::gram(const Mat & a, const Mat & b, Mat & k) const
+{
+	Mat left, right;
+	lhs->gram(a, b, left);
+	rhs->gram(a, b, right);
+	k = left.mul(right);
+}
+
+//The derivatives of one factor are scaled by the other factor
+void ProductKernel::gram(const Mat & x, Mat & k, vector<Mat> * grads) const
+{
+	Mat left, right;
+	size_t first = grads ? grads->size() : 0;
+	lhs->gram(x, left, grads);
+	size_t middle = grads ? grads->size() : 0;
+	rhs->gram(x, right, grads);
+	k = left.mul(right);
+
+	for (size_t i = first; grads && i < grads->size(); i++)
+	{
+		Mat & grad = (*grads)[i];
+		grad = grad.mul(i < middle ? right : left);
+	}
+}
+
+void ProductKernel::diagonal(const Mat & a, Mat & d) const
+{
+	Mat left, right;
+	lhs->diagonal(a, left);
+	rhs->diagonal(a, right);
+	d = left.mul(right);
+}
+
+KernelPtr operator+ (const KernelPtr & lhs, const KernelPtr & rhs)
+{
+	return std::make_shared<SumKernel>(lhs, rhs);
+}
+
+KernelPtr operator* (const KernelPtr & lhs, const KernelPtr & rhs)
+{
+	return std::make_shared<ProductKernel>(lhs, rhs);
+}
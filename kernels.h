@@ -0,0 +1,254 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <opencv2\core.hpp>
+
+using cv::Mat;
+using std::vector;
+
+class Kernel;
+typedef std::shared_ptr<Kernel> KernelPtr;
+
+//Covariance functions of the Gauss process. A kernel fills whole Gram
+//blocks: the distances come from one GEMM, the kernel values and their
+//derivatives from one pass over the block. The hyper-parameters are kept
+//in log space, so they stay positive under any update. All the matrices
+//are CV_64FC1 with one sample per row
+class Kernel
+{
+public:
+	virtual ~Kernel() { ; }
+
+	virtual KernelPtr clone() const = 0;
+	virtual int numOfParameters() const = 0;
+	vector<double> getParameters() const;
+	void setParameters(const vector<double> & p);
+
+	//P*Q Gram block between the rows of a and the rows of b
+	virtual void gram(const Mat & a, const Mat & b, Mat & k) const = 0;
+	//N*N Gram matrix of the rows of x. When grads is not null the derivatives
+	//with respect to the log parameters are appended to it, in the order of
+	//getParameters()
+	virtual void gram(const Mat & x, Mat & k, vector<Mat> * grads) const = 0;
+	//k(a_i, a_i) of every row of a, P*1
+	virtual void diagonal(const Mat & a, Mat & d) const = 0;
+
+	//p holds numOfParameters() log parameters
+	virtual void readParameters(double * p) const = 0;
+	virtual void writeParameters(const double * p) = 0;
+};
+
+//k = s2 * f(r2), with r2 the squared distance scaled by the lengthscales.
+//One lengthscale is isotropic, one per feature is ARD. The parameters are
+//log(s2), the log lengthscales and the log shape parameters, if any
+class StationaryKernel : public Kernel
+{
+public:
+	StationaryKernel(double variance, const vector<double> & lengthscales);
+
+	int numOfParameters() const override;
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override;
+	void writeParameters(const double * p) override;
+
+protected:
+	double logVariance;
+	vector<double> logLengths;
+	vector<double> logShapes;
+
+	//k = s2 * f(r2) of every element and, when g is not null, the
+	//derivative factor g = -2 * s2 * df/d(r2)
+	virtual void profile(const Mat & r2, double variance, Mat & k, Mat * g) const = 0;
+	//Appends the derivatives of the log shape parameters
+	virtual void shapeGradients(const Mat & r2, const Mat & k,
+		vector<Mat> & grads) const { ; }
+
+private:
+	Mat scaleRows(const Mat & a) const;
+};
+
+//s2 * exp(-r2 / 2)
+class RBFKernel : public StationaryKernel
+{
+public:
+	RBFKernel(double variance = 1.0, double lengthscale = 1.0) :
+		StationaryKernel(variance, vector<double>(1, lengthscale)) {}
+	RBFKernel(double variance, const vector<double> & lengthscales) :
+		StationaryKernel(variance, lengthscales) {}
+
+	KernelPtr clone() const override { return std::make_shared<RBFKernel>(*this); }
+
+protected:
+	void profile(const Mat & r2, double variance, Mat & k, Mat * g) const override;
+};
+
+//s2 * (1 + sqrt(3)r) * exp(-sqrt(3)r)
+class Matern32Kernel : public StationaryKernel
+{
+public:
+	Matern32Kernel(double variance = 1.0, double lengthscale = 1.0) :
+		StationaryKernel(variance, vector<double>(1, lengthscale)) {}
+	Matern32Kernel(double variance, const vector<double> & lengthscales) :
+		StationaryKernel(variance, lengthscales) {}
+
+	KernelPtr clone() const override { return std::make_shared<Matern32Kernel>(*this); }
+
+protected:
+	void profile(const Mat & r2, double variance, Mat & k, Mat * g) const override;
+};
+
+//s2 * (1 + sqrt(5)r + 5r2/3) * exp(-sqrt(5)r)
+class Matern52Kernel : public StationaryKernel
+{
+public:
+	Matern52Kernel(double variance = 1.0, double lengthscale = 1.0) :
+		StationaryKernel(variance, vector<double>(1, lengthscale)) {}
+	Matern52Kernel(double variance, const vector<double> & lengthscales) :
+		StationaryKernel(variance, lengthscales) {}
+
+	KernelPtr clone() const override { return std::make_shared<Matern52Kernel>(*this); }
+
+protected:
+	void profile(const Mat & r2, double variance, Mat & k, Mat * g) const override;
+};
+
+//s2 * (1 + r2 / (2a))^-a, the last parameter is log(a)
+class RationalQuadraticKernel : public StationaryKernel
+{
+public:
+	RationalQuadraticKernel(double variance = 1.0, double lengthscale = 1.0,
+		double alpha = 1.0);
+	RationalQuadraticKernel(double variance, const vector<double> & lengthscales,
+		double alpha);
+
+	KernelPtr clone() const override
+	{
+		return std::make_shared<RationalQuadraticKernel>(*this);
+	}
+
+protected:
+	void profile(const Mat & r2, double variance, Mat & k, Mat * g) const override;
+	void shapeGradients(const Mat & r2, const Mat & k,
+		vector<Mat> & grads) const override;
+};
+
+//s2 * exp(-2 * sin^2(pi * d / p) / l^2) with d the euclidean distance,
+//the parameters are log(s2), log(l) and log(p)
+class PeriodicKernel : public Kernel
+{
+public:
+	PeriodicKernel(double variance = 1.0, double lengthscale = 1.0, double period = 1.0);
+
+	KernelPtr clone() const override { return std::make_shared<PeriodicKernel>(*this); }
+	int numOfParameters() const override { return 3; }
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override;
+	void writeParameters(const double * p) override;
+
+private:
+	double logVariance;
+	double logLength;
+	double logPeriod;
+};
+
+//s2 * a'b
+class LinearKernel : public Kernel
+{
+public:
+	explicit LinearKernel(double variance = 1.0) : logVariance(std::log(variance)) {}
+
+	KernelPtr clone() const override { return std::make_shared<LinearKernel>(*this); }
+	int numOfParameters() const override { return 1; }
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override { p[0] = logVariance; }
+	void writeParameters(const double * p) override { logVariance = p[0]; }
+
+private:
+	double logVariance;
+};
+
+//c for every pair
+class ConstantKernel : public Kernel
+{
+public:
+	explicit ConstantKernel(double c = 1.0) : logValue(std::log(c)) {}
+
+	KernelPtr clone() const override { return std::make_shared<ConstantKernel>(*this); }
+	int numOfParameters() const override { return 1; }
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override { p[0] = logValue; }
+	void writeParameters(const double * p) override { logValue = p[0]; }
+
+private:
+	double logValue;
+};
+
+//Observation noise: s2 on the diagonal of the training Gram matrix only.
+//Blocks between two sets and the predictive variances do not include it
+class WhiteKernel : public Kernel
+{
+public:
+	explicit WhiteKernel(double noise = 1e-2) : logNoise(std::log(noise)) {}
+
+	KernelPtr clone() const override { return std::make_shared<WhiteKernel>(*this); }
+	int numOfParameters() const override { return 1; }
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override { p[0] = logNoise; }
+	void writeParameters(const double * p) override { logNoise = p[0]; }
+
+private:
+	double logNoise;
+};
+
+//lhs + rhs, the parameters of lhs come first
+class SumKernel : public Kernel
+{
+public:
+	SumKernel(const KernelPtr & l, const KernelPtr & r) : lhs(l), rhs(r) {}
+
+	KernelPtr clone() const override;
+	int numOfParameters() const override;
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override;
+	void writeParameters(const double * p) override;
+
+private:
+	KernelPtr lhs;
+	KernelPtr rhs;
+};
+
+//lhs * rhs element-wise, the parameters of lhs come first
+class ProductKernel : public Kernel
+{
+public:
+	ProductKernel(const KernelPtr & l, const KernelPtr & r) : lhs(l), rhs(r) {}
+
+	KernelPtr clone() const override;
+	int numOfParameters() const override;
+	void gram(const Mat & a, const Mat & b, Mat & k) const override;
+	void gram(const Mat & x, Mat & k, vector<Mat> * grads) const override;
+	void diagonal(const Mat & a, Mat & d) const override;
+	void readParameters(double * p) const override;
+	void writeParameters(const double * p) override;
+
+private:
+	KernelPtr lhs;
+	KernelPtr rhs;
+};
+
+KernelPtr operator+ (const KernelPtr & lhs, const KernelPtr & rhs);
+KernelPtr operator* (const KernelPtr & lhs, const KernelPtr & rhs);
@@ -1,65 +1,311 @@
 #include "kmeans.h"
+#include "centroidtree.h"
 
+//从检查点恢复时只继续检查点中的那一次运行，多次重启只用于从头训练
 void Kmeans::train()
 {
-	//随机初始化K个类别的均值向量
-	std::default_random_engine e;
-	std::uniform_int_distribution<int> u(0, dataSet.rows - 1);
-	for (int i = 0; i < K; i++)
+	index.reset();
+	telemetry.beginTraining();
+	int start = firstIteration();
+	if (start == 0)
 	{
-		int randomVal = u(e);
-		double * meanPtr = preMeans.ptr<double>(i);
-		double * distPtr = dataSet.ptr<double>(randomVal);
-		for (int j = 0; j < dataSet.cols; j++)
-			*meanPtr++ = *distPtr++;
+		//前一次二分k均值得到的类别数可能少于要求的K
+		K = requestedK;
+		curMeans.create(K, dataSet.cols, CV_64FC1);
+		preMeans.create(K, dataSet.cols, CV_64FC1);
+		kinds.assign(K, vector<int>());
 	}
 
-	for (int i = 0; i < iters; i++)
+	if (start == 0 && bisecting)
+		trainBisecting();
+	else
 	{
-		//为每一个数据点分配类别
-		for (int j = 0; j < dataSet.rows; j++)
+		if (start == 0 && restarts > 1)
+			trainRestarts();
+		else
+			iterate(start, true);
+		inertia = meanDistance(dataSet) * dataSet.rows;
+	}
+	finishTraining();
+	telemetry.endTraining();
+}
+
+//一次完整的迭代过程，start为0时按种子随机初始化K个类别的均值向量，
+//否则沿用检查点中的均值向量；hooks为false时不做验证也不写检查点
+void Kmeans::iterate(int start, bool hooks)
+{
+	if (start == 0)
+	{
+		std::default_random_engine e(seed);
+		std::uniform_int_distribution<int> u(0, dataSet.rows - 1);
+		for (int i = 0; i < K; i++)
 		{
-			minDist.clear();
-			for (int k = 0; k < K; k++)
-			{
-				double dist = 
-					calculateDist(dataSet.row(j), preMeans.row(k));
-				minDist.insert(std::make_pair(dist, k));
-			}
+			int randomVal = u(e);
+			double * meanPtr = preMeans.ptr<double>(i);
+			double * distPtr = dataSet.ptr<double>(randomVal);
+			for (int j = 0; j < dataSet.cols; j++)
+				*meanPtr++ = *distPtr++;
+		}
+	}
 
-			//根据最小距离的数据索引值，将改数据添加到相应的类别容器中
-			auto min = minDist.begin();
-			kinds[min->second].push_back(j);
+	assignments.assign(dataSet.rows, 0);
+	for (int i = start; i < iters; i++)
+	{
+		{
+			//并行地为每一个数据点分配最近的类别
+			Telemetry::Timer timer(telemetry, Telemetry::ASSIGNMENT);
+			updateAssignments();
+
+			//根据最小距离的数据索引值，将该数据添加到相应的类别容器中
+			for (auto & ele : kinds)
+				ele.clear();
+			for (int j = 0; j < dataSet.rows; j++)
+				kinds[assignments[j]].push_back(j);
 		}
 
 		//根据更新的索引值计算当前的K个类的均值向量，并进行误差计算
-		updateKMeans();
-		double error = calculateError();
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::UPDATE);
+			updateKMeans();
+		}
+		double error;
+		{
+			Telemetry::Timer timer(telemetry, Telemetry::EVALUATE);
+			error = calculateError();
+		}
 		errors.push_back(error);
-		if (error < threshold)
+		curMeans.copyTo(preMeans);
+		telemetry.endIteration(error, dataSet.rows);
+		if ((hooks && !continueTraining(i)) || error < threshold)
 			break;
+	}
+}
+
+//各次重启并行运行并共享只读的数据集：第0次在本对象上运行，其余各次在
+//不同种子的副本上运行，最后保留惯性最小的一次
+void Kmeans::trainRestarts()
+{
+	vector<std::unique_ptr<Kmeans>> runs(restarts);
+	vector<double> inertias(restarts, DBL_MAX);
+	executor->parallelFor(0, restarts, [&](int first, int last)
+	{
+		for (int r = first; r < last; r++)
+		{
+			if (stopRequested())
+				continue;
+
+			Kmeans * run = this;
+			if (r > 0)
+			{
+				runs[r].reset(new Kmeans(dataSet, K, threshold, iters));
+				run = runs[r].get();
+				run->metric = metric;
+				run->seed = seed + r;
+				run->executor = executor;
+			}
+			run->iterate(0, false);
+			inertias[r] = run->meanDistance(dataSet);
+		}
+	});
 
-		//清空类别容器
-		for (auto ele : kinds)
-			ele.clear();
+	auto bestRun = std::min_element(inertias.begin(), inertias.end());
+	int best = static_cast<int>(bestRun - inertias.begin());
+	if (best > 0)
+	{
+		Kmeans & run = *runs[best];
+		curMeans = run.curMeans;
+		preMeans = run.preMeans;
+		errors = run.errors;
+		kinds = run.kinds;
+		assignments = run.assignments;
 	}
 }
 
-int Kmeans::predict(Mat & data)
+//二分k均值按层进行：同一层中互不相关的节点并行地用2均值一分为二，
+//每个节点的目标类别数按两个子节点的样本数分配。不能再划分的节点成为
+//叶子，即最终的类别；所有划分组成的二叉树作为预测时的索引。
+//数据点太少而无法分出K个类别时，K随之减小，要求的类别数仍保留在
+//requestedK中，下一次训练重新使用它
+void Kmeans::trainBisecting()
 {
-	int kind = 0;
-	double maxDist = 0.0;
+	struct Pending
+	{
+		int node;
+		int kinds;
+		vector<int> members;
+	};
+
+	vector<CentroidTree::Node> nodes(1);
+	vector<Pending> frontier(1);
+	frontier[0].node = 0;
+	frontier[0].kinds = std::min(K, dataSet.rows);
+	frontier[0].members.resize(dataSet.rows);
+	for (int i = 0; i < dataSet.rows; i++)
+		frontier[0].members[i] = i;
+
+	vector<Mat> leafCenters;
+	vector<vector<int>> leafMembers;
+	while (!frontier.empty())
+	{
+		//每个节点的中心与划分互不相关，并行计算；收到停止请求后不再划分
+		bool stop = stopRequested();
+		vector<vector<vector<int>>> groups(frontier.size());
+		executor->parallelFor(0, static_cast<int>(frontier.size()), [&](int first, int last)
+		{
+			for (int f = first; f < last; f++)
+			{
+				Pending & cur = frontier[f];
+				Mat center(1, dataSet.cols, CV_64FC1);
+				calculateCenter(cur.members, center);
+				nodes[cur.node].center = center;
+				if (!stop && cur.kinds > 1)
+					groups[f] = bisect(cur.members, seed + cur.node);
+			}
+		});
+
+		vector<Pending> next;
+		long long samples = 0;
+		for (size_t f = 0; f < frontier.size(); f++)
+		{
+			Pending & cur = frontier[f];
+			samples += cur.members.size();
+			if (groups[f].size() != 2)
+			{
+				CentroidTree::Node & node = nodes[cur.node];
+				node.first = static_cast<int>(leafCenters.size());
+				node.last = node.first + 1;
+				node.leaf = true;
+				leafCenters.push_back(node.center);
+				leafMembers.push_back(std::move(cur.members));
+				continue;
+			}
+
+			//两个子节点至少各分得一个类别，且类别数不超过其样本数
+			int n0 = static_cast<int>(groups[f][0].size());
+			int n1 = static_cast<int>(groups[f][1].size());
+			double share = static_cast<double>(n0) / (n0 + n1);
+			int k0 = static_cast<int>(std::round(cur.kinds * share));
+			k0 = std::max(k0, std::max(1, cur.kinds - n1));
+			k0 = std::min(k0, std::min(n0, cur.kinds - 1));
+
+			int child = static_cast<int>(nodes.size());
+			nodes.resize(child + 2);
+			CentroidTree::Node & parent = nodes[cur.node];
+			parent.first = child;
+			parent.last = child + 2;
+			parent.leaf = false;
+			next.push_back(Pending{ child, k0, std::move(groups[f][0]) });
+			next.push_back(Pending{ child + 1, cur.kinds - k0, std::move(groups[f][1]) });
+		}
+
+		//每一层作为一次迭代，以已得到的类别数代替损失值
+		telemetry.endIteration(static_cast<double>(leafCenters.size()), samples);
+		frontier.swap(next);
+	}
+
+	K = static_cast<int>(leafCenters.size());
+	curMeans.create(K, dataSet.cols, CV_64FC1);
+	kinds.assign(K, vector<int>());
+	assignments.assign(dataSet.rows, 0);
+	vector<int> items(K);
 	for (int k = 0; k < K; k++)
 	{
-		double curDist = calculateDist(data, curMeans.row(k));
-		if (curDist > maxDist)
+		Mat curMean = curMeans.row(k);
+		leafCenters[k].copyTo(curMean);
+		for (auto ele : leafMembers[k])
+			assignments[ele] = k;
+		kinds[k].swap(leafMembers[k]);
+		items[k] = k;
+	}
+	curMeans.copyTo(preMeans);
+	index = std::make_shared<CentroidTree>(curMeans, metric,
+		std::move(nodes), std::move(items));
+
+	//每个数据点属于其所在的叶子，惯性不必再搜索最近的均值向量
+	inertia = executor->parallelReduce(0, dataSet.rows, 0.0, [&](int first, int last)
+	{
+		double sum = 0.0;
+		for (int i = first; i < last; i++)
+			sum += calculateDist(dataSet.row(i), curMeans.row(assignments[i]));
+
+		return sum;
+	}, std::plus<double>(), 256);
+}
+
+//用2均值划分一组数据点，两个初始均值可能取到同一个点，因此失败时换一个种子
+//重试。返回的两组均非空，无法划分时返回空
+vector<vector<int>> Kmeans::bisect(const vector<int> & members, unsigned int s) const
+{
+	if (members.size() < 2)
+		return vector<vector<int>>();
+
+	//根节点包含全部数据，不必复制
+	Mat subset = dataSet;
+	if (static_cast<int>(members.size()) != dataSet.rows)
+	{
+		subset.create(static_cast<int>(members.size()), dataSet.cols, CV_64FC1);
+		for (int i = 0; i < subset.rows; i++)
 		{
-			kind = k;
-			maxDist = curDist;
+			Mat row = subset.row(i);
+			dataSet.row(members[i]).copyTo(row);
 		}
 	}
 
-	return kind + 1;
+	for (int attempt = 0; attempt < 3; attempt++)
+	{
+		Kmeans two(subset, 2, threshold, iters);
+		two.setMetric(metric);
+		two.setSeed(s + attempt * 7919);
+		two.setExecutor(*executor);
+		two.train();
+
+		auto & twoKinds = two.showKinds();
+		if (twoKinds[0].empty() || twoKinds[1].empty())
+			continue;
+
+		vector<vector<int>> groups(2);
+		for (int g = 0; g < 2; g++)
+			for (auto ele : twoKinds[g])
+				groups[g].push_back(members[ele]);
+
+		return groups;
+	}
+
+	return vector<vector<int>>();
+}
+
+int Kmeans::predict(Mat & data)
+{
+	if (index)
+		return index->nearest(data, searchWidth) + 1;
+
+	return nearestMean(data, curMeans) + 1;
+}
+
+vector<int> Kmeans::predictBatch(const Mat & datas) const
+{
+	if (datas.cols != curMeans.cols)
+		throw std::exception("Invalid input data!");
+
+	vector<int> result(datas.rows);
+	executor->parallelFor(0, datas.rows, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			Mat point = datas.row(i);
+			int kind = index ? index->nearest(point, searchWidth) :
+				nearestMean(point, curMeans);
+			result[i] = kind + 1;
+		}
+	}, 64);
+
+	return result;
+}
+
+void Kmeans::buildIndex(int branching, int leafSize)
+{
+	index = std::make_shared<CentroidTree>(curMeans, metric,
+		branching, leafSize, *executor);
 }
 
 vector<double>& Kmeans::showErrors()
@@ -72,28 +318,188 @@ const vector<double>& Kmeans::showErrors() const
 	return errors;
 }
 
-double Kmeans::calculateDist(Mat & rhs, Mat & lhs)
+//检查点保存均值向量、误差历史和距离度量，类别划分在下一次迭代开始时
+//重新计算。度量不同的均值向量不能继续训练，读取时拒绝
+void Kmeans::saveState(cv::FileStorage & fs) const
+{
+	fs << "metric" << static_cast<int>(metric);
+	fs << "means" << curMeans;
+	fs << "errors" << errors;
+}
+
+void Kmeans::loadState(const cv::FileNode & node)
+{
+	Mat means;
+	int savedMetric;
+	node["metric"] >> savedMetric;
+	node["means"] >> means;
+	if (means.rows != K || means.cols != dataSet.cols || savedMetric != metric)
+		throw std::exception("The checkpoint does not match the model!");
+
+	means.copyTo(curMeans);
+	means.copyTo(preMeans);
+	node["errors"] >> errors;
+}
+
+//验证损失为验证集中的点在所选度量下到最近均值向量的平均距离
+double Kmeans::validationLoss(const Mat & data, const Mat & targets) const
+{
+	return meanDistance(data);
+}
+
+double Kmeans::meanDistance(const Mat & data) const
+{
+	auto partialLoss = [&](int first, int last)
+	{
+		double sum = 0.0;
+		for (int i = first; i < last; i++)
+		{
+			Mat point = data.row(i);
+			sum += calculateDist(point, curMeans.row(nearestMean(point, curMeans)));
+		}
+
+		return sum;
+	};
+
+	double loss = executor->parallelReduce(0, data.rows, 0.0,
+		partialLoss, std::plus<double>(), 256);
+
+	return loss / data.rows;
+}
+
+double Kmeans::calculateDist(const Mat & rhs, const Mat & lhs) const
 {
 	if (rhs.rows != lhs.rows || rhs.cols != lhs.cols)
 		throw std::exception("Two vectors must have the same size!");
 
-	Mat diff = rhs - lhs;
-	double dot = diff.dot(diff);
+	return distance(rhs, lhs, metric);
+}
 
-	return dot;
+//不生成差向量，直接计算距离；余弦距离要求两个向量均为单位向量
+double Kmeans::distance(const Mat & rhs, const Mat & lhs, Metric m)
+{
+	switch (m)
+	{
+	case Kmeans::COSINE:
+		return 1.0 - rhs.dot(lhs);
+	case Kmeans::MANHATTAN:
+		return cv::norm(rhs, lhs, cv::NORM_L1);
+	default:
+		return cv::norm(rhs, lhs, cv::NORM_L2SQR);
+	}
+}
+
+int Kmeans::nearestMean(const Mat & point, const Mat & means) const
+{
+	int kind = 0;
+	double minDist = calculateDist(point, means.row(0));
+	for (int k = 1; k < K; k++)
+	{
+		double curDist = calculateDist(point, means.row(k));
+		if (curDist < minDist)
+		{
+			kind = k;
+			minDist = curDist;
+		}
+	}
+
+	return kind;
+}
+
+//欧氏距离与余弦距离按数据块批量计算：||x-m||^2 = ||x||^2 - 2x*m' + ||m||^2，
+//其中||x||^2不影响最近的类别；单位向量的余弦距离为1 - x*m'。
+//因此每个数据块只需一次GEMM，曼哈顿距离则逐个计算
+void Kmeans::updateAssignments()
+{
+	if (metric == MANHATTAN)
+	{
+		executor->parallelFor(0, dataSet.rows, [&](int first, int last)
+		{
+			for (int j = first; j < last; j++)
+				assignments[j] = nearestMean(dataSet.row(j), preMeans);
+		}, 256);
+		return;
+	}
+
+	double scale = metric == SQEUCLIDEAN ? -2.0 : -1.0;
+	vector<double> meanNorms(K, 0.0);
+	for (int k = 0; metric == SQEUCLIDEAN && k < K; k++)
+		meanNorms[k] = preMeans.row(k).dot(preMeans.row(k));
+
+	//每个线程按固定的行块做GEMM，得分矩阵只有blockRows*K，与分到的行数无关
+	executor->parallelFor(0, dataSet.rows, [&](int first, int last)
+	{
+		Scratch::Frame frame;
+		Mat buffer = frame.take(std::min(last - first, Scratch::blockRows), K);
+		for (int begin = first; begin < last; begin += Scratch::blockRows)
+		{
+			int end = std::min(begin + Scratch::blockRows, last);
+			Mat scores = buffer.rowRange(0, end - begin);
+			cv::gemm(dataSet.rowRange(begin, end), preMeans, scale,
+				cv::noArray(), 0.0, scores, cv::GEMM_2_T);
+
+			for (int j = begin; j < end; j++)
+			{
+				const double * scorePtr = scores.ptr<double>(j - begin);
+				int kind = 0;
+				double minDist = scorePtr[0] + meanNorms[0];
+				for (int k = 1; k < K; k++)
+				{
+					double curDist = scorePtr[k] + meanNorms[k];
+					if (curDist < minDist)
+					{
+						kind = k;
+						minDist = curDist;
+					}
+				}
+				assignments[j] = kind;
+			}
+		}
+	}, 256);
 }
 
 void Kmeans::updateKMeans()
 {
-	for (int k = 0; k < K; k++)
+	//各个类别的均值向量互不相关，并行计算；空的类别保留原来的均值
+	executor->parallelFor(0, K, [&](int first, int last)
 	{
-		Mat curMean = curMean.row(k);
-		for (auto ele : kinds[k])
+		for (int k = first; k < last; k++)
 		{
-			curMean = curMean + dataSet.row(ele);
+			Mat curMean = curMeans.row(k);
+			if (kinds[k].empty())
+				preMeans.row(k).copyTo(curMean);
+			else
+				calculateCenter(kinds[k], curMean);
 		}
-		curMean = curMean / kinds[k].size();
+	});
+}
+
+//一组数据点的中心：欧氏距离取均值；球面k均值的均值投影回单位球面；
+//k中值在每一维上取中位数，使类内的L1距离之和最小
+void Kmeans::calculateCenter(const vector<int> & members, Mat & center) const
+{
+	if (metric == MANHATTAN)
+	{
+		vector<double> values(members.size());
+		double * centerPtr = center.ptr<double>(0);
+		for (int d = 0; d < dataSet.cols; d++)
+		{
+			for (size_t i = 0; i < values.size(); i++)
+				values[i] = dataSet.at<double>(members[i], d);
+
+			auto mid = values.begin() + values.size() / 2;
+			std::nth_element(values.begin(), mid, values.end());
+			centerPtr[d] = *mid;
+		}
+		return;
 	}
+
+	center.setTo(cv::Scalar(0));
+	for (auto ele : members)
+		center += dataSet.row(ele);
+	center /= static_cast<double>(members.size());
+	if (metric == COSINE)
+		cv::normalize(center, center);
 }
 
 double Kmeans::calculateError()
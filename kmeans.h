@@ -7,8 +7,11 @@
 #include <opencv2\core.hpp>
 #include <algorithm>
 #include <random>
+#include <memory>
+#include <cfloat>
 
 #include "mlbase.h"
+#include "scratch.h"
 
 using cv::Mat;
 using std::vector;
@@ -17,12 +20,21 @@ using std::pair;
 using std::cout;
 using std::endl;
 
+class CentroidTree;
 
 class Kmeans : public MLBase
 {
+public:
+	//SQEUCLIDEAN is the classic k-means, COSINE is spherical k-means and
+	//expects rows of unit length, MANHATTAN is k-medians
+	enum Metric
+	{
+		SQEUCLIDEAN, COSINE, MANHATTAN
+	};
+
 public:
 	Kmeans(Mat & datas, int k, double t = 0.005, int i = 100)
-	try : dataSet(datas), K(k), threshold(t), iters(i)
+	try : dataSet(datas), K(k), requestedK(k), threshold(t), iters(i)
 	{
 		if (K <= 1)
 			throw std::exception("Kinds must greater than zero!");
@@ -38,13 +50,64 @@ public:
 
 	void train() override;
 	int predict(Mat & data);
+	//datas is N*D, every row is a sample
+	vector<int> predictBatch(const Mat & datas) const;
 	void setKinds(int k)
 	{
 		if (k >= 1)
-			K = k;
+			K = requestedK = k;
+	}
+	//Number of means of the trained model, a bisecting run may find fewer
+	//than the requested kinds
+	int numOfKinds() const { return K; }
+	//The index was built for the old metric, so it is dropped
+	void setMetric(Metric m)
+	{
+		metric = m;
+		index.reset();
+	}
+	Metric getMetric() const
+	{
+		return metric;
+	}
+	//Number of random starts, run in parallel on the executor. The start
+	//with the smallest inertia is kept, start r is seeded with seed + r.
+	//Bisecting k-means ignores it and always runs once
+	void setRestarts(int n)
+	{
+		if (n >= 1)
+			restarts = n;
 	}
+	void setSeed(unsigned int s)
+	{
+		seed = s;
+	}
+	//Bisecting k-means: the clusters are split with 2-means until there are
+	//K of them, and the tree of the splits becomes the index of predict
+	void setBisecting(bool b)
+	{
+		bisecting = b;
+	}
+	//Sum of the distances between the samples and their nearest means
+	double showInertia() const { return inertia; }
+
+	//Indexing the means with a hierarchical k-means tree after training,
+	//predict then searches the tree instead of scanning all the K means.
+	//Training again drops the index
+	void buildIndex(int branching = 16, int leafSize = 32);
+	void dropIndex() { index.reset(); }
+	//Number of tree nodes kept per level, larger widths give a better recall
+	void setSearchWidth(int w)
+	{
+		if (w >= 1)
+			searchWidth = w;
+	}
+
+	static double distance(const Mat & rhs, const Mat & lhs, Metric m);
 	vector<double> & showErrors() override;
 	const vector<double> & showErrors() const override;
+	vector<double> & showLossFuncVals() override { return errors; }
+	const vector<double> & showLossFuncVals() const override { return errors; }
 	Mat & showMeans() { return curMeans; }
 	vector<vector<int>> & showKinds() { return kinds; }
 
@@ -56,11 +119,30 @@ private:
 	double threshold;
 	int iters;
 	int K;
+	int requestedK;
+	Metric metric = SQEUCLIDEAN;
+	int restarts = 1;
+	bool bisecting = false;
+	unsigned int seed = std::default_random_engine::default_seed;
+	double inertia = 0.0;
 	vector<double> errors;
 	vector<vector<int>> kinds;
-	map<double, int> minDist;
+	vector<int> assignments;
+	std::shared_ptr<const CentroidTree> index;
+	int searchWidth = 4;
 
-	double calculateDist(Mat & rhs, Mat & lhs);
+	void saveState(cv::FileStorage & fs) const override;
+	void loadState(const cv::FileNode & node) override;
+	double validationLoss(const Mat & data, const Mat & targets) const override;
+	double calculateDist(const Mat & rhs, const Mat & lhs) const;
+	int nearestMean(const Mat & point, const Mat & means) const;
+	double meanDistance(const Mat & data) const;
+	void iterate(int start, bool hooks);
+	void trainRestarts();
+	void trainBisecting();
+	vector<vector<int>> bisect(const vector<int> & members, unsigned int s) const;
+	void updateAssignments();
 	void updateKMeans();
+	void calculateCenter(const vector<int> & members, Mat & center) const;
 	double calculateError();
 };
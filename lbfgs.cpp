@@ -0,0 +1,165 @@
+#include "lbfgs.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+	double dot(const vector<double> & a, const vector<double> & b)
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < a.size(); i++)
+			sum += a[i] * b[i];
+
+		return sum;
+	}
+
+	double maxAbs(const vector<double> & a)
+	{
+		double rst = 0.0;
+		for (auto ele : a)
+			rst = std::max(rst, std::abs(ele));
+
+		return rst;
+	}
+}
+
+LBFGS::LBFGS(int m, int i, double e) :
+	memory(m), maxIters(i), elipson(e)
+{
+	if (m < 1 || i < 1 || e < 0.0)
+		throw std::exception("Invalid parameters!");
+}
+
+//The line search brackets the step: a step breaking the Armijo condition
+//is too long, one breaking the curvature condition is too short. Without
+//an upper bound the step doubles, otherwise the bracket is bisected
+double LBFGS::minimize(const Objective & f, vector<double> & x, const Progress & progress)
+{
+	iterations = evaluations = 0;
+	size_t n = x.size();
+	vector<double> g(n), d(n), xNew(n), gNew(n), xLo, gLo;
+	double fx = f(x, g);
+	evaluations++;
+
+	vector<vector<double>> s, y;
+	vector<double> rho;
+	const double inf = std::numeric_limits<double>::infinity();
+	for (int i = 0; i < maxIters && maxAbs(g) > elipson; i++)
+	{
+		direction(g, s, y, rho, d);
+		double slope = dot(g, d);
+		if (!(slope < 0.0))
+		{
+			//Not a descent direction, starting over from the steepest descent
+			s.clear();
+			y.clear();
+			rho.clear();
+			for (size_t j = 0; j < n; j++)
+				d[j] = -g[j];
+			slope = -dot(g, g);
+		}
+
+		//Without curvature pairs the first step moves x by at most one unit
+		double t = s.empty() ? std::min(1.0, 1.0 / std::sqrt(-slope)) : 1.0;
+		double lo = 0.0, hi = inf;
+		double fNew = 0.0, fLo = 0.0;
+		bool accepted = false;
+		for (int e = 0; e < maxEvaluations && !accepted; e++)
+		{
+			for (size_t j = 0; j < n; j++)
+				xNew[j] = x[j] + t * d[j];
+			fNew = f(xNew, gNew);
+			evaluations++;
+
+			if (!(fNew <= fx + armijo * t * slope))
+				hi = t;
+			else if (dot(gNew, d) < curvature * slope)
+			{
+				lo = t;
+				xLo = xNew;
+				gLo = gNew;
+				fLo = fNew;
+			}
+			else
+				accepted = true;
+
+			t = hi < inf ? 0.5 * (lo + hi) : 2.0 * lo;
+		}
+
+		//Out of evaluations, the longest step with enough decrease is taken
+		if (!accepted && lo > 0.0)
+		{
+			xNew = xLo;
+			gNew = gLo;
+			fNew = fLo;
+			accepted = true;
+		}
+		if (!accepted)
+			break;
+
+		vector<double> sk(n), yk(n);
+		for (size_t j = 0; j < n; j++)
+		{
+			sk[j] = xNew[j] - x[j];
+			yk[j] = gNew[j] - g[j];
+		}
+		double sy = dot(sk, yk);
+		if (sy > 1e-12 * dot(yk, yk))
+		{
+			s.push_back(sk);
+			y.push_back(yk);
+			rho.push_back(1.0 / sy);
+			if (static_cast<int>(s.size()) > memory)
+			{
+				s.erase(s.begin());
+				y.erase(y.begin());
+				rho.erase(rho.begin());
+			}
+		}
+
+		double decrease = fx - fNew;
+		x.swap(xNew);
+		g.swap(gNew);
+		fx = fNew;
+		iterations++;
+		if ((progress && !progress(i, x, fx)) ||
+			decrease <= elipson * std::max(1.0, std::abs(fx)))
+			break;
+	}
+
+	return fx;
+}
+
+//Two-loop recursion, d = -H * g with H the inverse Hessian built from the
+//curvature pairs on top of a scaled identity
+void LBFGS::direction(const vector<double> & g, const vector<vector<double>> & s,
+	const vector<vector<double>> & y, const vector<double> & rho,
+	vector<double> & d) const
+{
+	int k = static_cast<int>(s.size());
+	vector<double> alpha(k);
+	d = g;
+	for (int i = k - 1; i >= 0; i--)
+	{
+		alpha[i] = rho[i] * dot(s[i], d);
+		for (size_t j = 0; j < d.size(); j++)
+			d[j] -= alpha[i] * y[i][j];
+	}
+
+	double gamma = k > 0 ? 1.0 / (rho[k - 1] * dot(y[k - 1], y[k - 1])) : 1.0;
+	for (auto & ele : d)
+		ele *= gamma;
+
+	for (int i = 0; i < k; i++)
+	{
+		double beta = rho[i] * dot(y[i], d);
+		for (size_t j = 0; j < d.size(); j++)
+			d[j] += (alpha[i] - beta) * s[i][j];
+	}
+
+	for (auto & ele : d)
+		ele = -ele;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+using std::vector;
+
+//Limited-memory BFGS minimizer. The inverse Hessian is approximated from
+//the last m steps by the two-loop recursion, the step length is chosen by
+//a bisection line search under the weak Wolfe conditions. Every evaluation
+//returns the value and the gradient together, so a caller sharing work
+//between them (e.g. one matrix factorization) pays for it once
+class LBFGS
+{
+public:
+	//Returns f(x) and writes the gradient of f at x into g. +inf marks a
+	//point outside the domain of f, the line search then shortens the step
+	using Objective = std::function<double(const vector<double> & x, vector<double> & g)>;
+	//Called after every iteration with the accepted point, false stops
+	using Progress = std::function<bool(int iteration, const vector<double> & x, double fx)>;
+
+	//m steps are remembered, at most i iterations are done. The search stops
+	//when the relative decrease of f or the largest gradient element falls
+	//under e
+	explicit LBFGS(int m = 10, int i = 100, double e = 1e-5);
+
+	//Armijo constant c1, curvature constant c2 and the number of evaluations
+	//a line search may use
+	void setLineSearch(double c1, double c2, int evaluations)
+	{
+		if (c1 > 0.0 && c1 < c2 && c2 < 1.0 && evaluations > 0)
+		{
+			armijo = c1;
+			curvature = c2;
+			maxEvaluations = evaluations;
+		}
+	}
+
+	//Minimizes f starting from x, which holds the best point afterwards.
+	//Returns f at that point
+	double minimize(const Objective & f, vector<double> & x,
+		const Progress & progress = Progress());
+
+	int numOfIterations() const { return iterations; }
+	int numOfEvaluations() const { return evaluations; }
+
+private:
+	int memory;
+	int maxIters;
+	double elipson;
+	double armijo = 1e-4;
+	double curvature = 0.9;
+	int maxEvaluations = 20;
+	int iterations = 0;
+	int evaluations = 0;
+
+	void direction(const vector<double> & g, const vector<vector<double>> & s,
+		const vector<vector<double>> & y, const vector<double> & rho,
+		vector<double> & d) const;
+};
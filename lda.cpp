@@ -0,0 +1,146 @@
+#include "lda.h"
+
+LDA::LDA(Mat & l, Mat & d, int n)
+try : dataSet(d), numOfDims(n), regularization(1e-6)
+{
+	if (l.rows != d.rows || l.cols != 1 || d.rows < 2 || n < 0)
+		throw std::exception("Invalid input data!");
+
+	l.convertTo(labels, CV_32SC1);
+
+	//Mapping the label values to continuous class indices
+	map<int, int> classMap;
+	classIndex.resize(labels.rows);
+	for (int i = 0; i < labels.rows; i++)
+	{
+		int label = labels.at<int>(i, 0);
+		auto iter = classMap.find(label);
+		if (iter == classMap.end())
+		{
+			iter = classMap.insert(std::make_pair(label,
+				static_cast<int>(classMap.size()))).first;
+			classCount.push_back(0);
+		}
+
+		classIndex[i] = iter->second;
+		classCount[iter->second]++;
+	}
+
+	numOfClasses = static_cast<int>(classMap.size());
+	if (numOfClasses < 2)
+		throw std::exception("At least two classes are needed!");
+
+	//At most c-1 discriminants carry information
+	int maxDims = std::min(numOfClasses - 1, dataSet.cols);
+	if (numOfDims == 0 || numOfDims > maxDims)
+		numOfDims = maxDims;
+
+	means = Mat::zeros(numOfClasses, dataSet.cols, CV_64FC1);
+	totalMean = Mat::zeros(1, dataSet.cols, CV_64FC1);
+	Sw = Mat::zeros(dataSet.cols, dataSet.cols, CV_64FC1);
+	Sb = Mat::zeros(dataSet.cols, dataSet.cols, CV_64FC1);
+}
+catch (const std::exception & e)
+{
+	cout << e.what() << endl;
+}
+
+void LDA::train()
+{
+	calculateMeans();
+	calculateScatters();
+	solveEigenProblem();
+}
+
+//datas must be a N*D matrix, returns the N*numOfDims projection
+Mat LDA::transform(const Mat & datas) const
+{
+	if (datas.cols != projection.rows)
+		throw std::exception("Invalid input data!");
+
+	//One GEMM for the whole batch, the centering is folded into offset
+	Mat rst;
+	cv::gemm(datas, projection, 1.0, cv::noArray(), 0.0, rst);
+	for (int i = 0; i < rst.rows; i++)
+	{
+		double * rstPtr = rst.ptr<double>(i);
+		const double * offPtr = offset.ptr<double>(0);
+		for (int j = 0; j < rst.cols; j++)
+			*rstPtr++ -= *offPtr++;
+	}
+
+	return rst;
+}
+
+vector<double> LDA::showEigenvalues() const
+{
+	return (vector<double>)(eigenvalues.reshape(1, 1));
+}
+
+void LDA::calculateMeans()
+{
+	means = Mat::zeros(numOfClasses, dataSet.cols, CV_64FC1);
+	for (int i = 0; i < dataSet.rows; i++)
+	{
+		const double * dataPtr = dataSet.ptr<double>(i);
+		double * meanPtr = means.ptr<double>(classIndex[i]);
+		for (int j = 0; j < dataSet.cols; j++)
+			*meanPtr++ += *dataPtr++;
+	}
+
+	totalMean = Mat::zeros(1, dataSet.cols, CV_64FC1);
+	for (int c = 0; c < numOfClasses; c++)
+	{
+		totalMean += means.row(c);
+		means.row(c) /= classCount[c];
+	}
+	totalMean /= dataSet.rows;
+}
+
+void LDA::calculateScatters()
+{
+	//Total scatter in one pass over the data, St = Sw + Sb
+	Mat St;
+	cv::mulTransposed(dataSet, St, true, totalMean);
+
+	//Between-class scatter from the c class means only
+	Mat weighted(numOfClasses, dataSet.cols, CV_64FC1);
+	for (int c = 0; c < numOfClasses; c++)
+	{
+		Mat row = weighted.row(c);
+		Mat diff = means.row(c) - totalMean;
+		diff = diff * std::sqrt(static_cast<double>(classCount[c]));
+		diff.copyTo(row);
+	}
+	cv::mulTransposed(weighted, Sb, true);
+
+	Sw = St - Sb;
+}
+
+void LDA::solveEigenProblem()
+{
+	//Regularizing Sw, so that singular scatter matrices can be whitened
+	double ridge = regularization *
+		std::max(cv::trace(Sw).val[0] / Sw.rows, 1.0);
+	Mat SwReg = Sw + ridge * Mat::eye(Sw.rows, Sw.cols, CV_64FC1);
+
+	//Whitening transform W = U * diag(1/sqrt(lambda)) of Sw
+	Mat swVals, swVecs;
+	cv::eigen(SwReg, swVals, swVecs);
+	Mat whiten = swVecs.t();
+	for (int j = 0; j < whiten.cols; j++)
+	{
+		double val = std::max(swVals.at<double>(j, 0), ridge);
+		whiten.col(j) *= 1.0 / std::sqrt(val);
+	}
+
+	//Sb*w = lambda*Sw*w reduces to a symmetric problem in whitened space
+	Mat reduced = whiten.t() * Sb * whiten;
+	Mat vals, vecs;
+	cv::eigen(reduced, vals, vecs);
+
+	//cv::eigen sorts eigenvalues in descending order
+	projection = whiten * vecs.rowRange(0, numOfDims).t();
+	eigenvalues = vals.rowRange(0, numOfDims).clone();
+	offset = totalMean * projection;
+}
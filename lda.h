@@ -0,0 +1,51 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <opencv2\core.hpp>
+
+using cv::Mat;
+using std::map;
+using std::vector;
+using std::cout;
+using std::endl;
+
+//Multi-class linear discriminant analysis. Every row of the data matrix
+//is a sample, labels is a N*1 matrix of class ids (any integer values).
+class LDA
+{
+public:
+	LDA(Mat & l, Mat & d, int n = 0);
+	LDA(const LDA &) = delete;
+	LDA & operator= (const LDA &) = delete;
+
+	void train();
+	Mat transform(const Mat & datas) const;
+	int numOfComponents() const { return numOfDims; }
+	Mat & showProjection() { return projection; }
+	const Mat & showProjection() const { return projection; }
+	vector<double> showEigenvalues() const;
+
+private:
+	Mat labels;
+	Mat dataSet;
+	Mat means;
+	Mat totalMean;
+	Mat Sw;
+	Mat Sb;
+	Mat projection;
+	Mat offset;
+	Mat eigenvalues;
+
+	int numOfClasses;
+	int numOfDims;
+	double regularization;
+	vector<int> classIndex;
+	vector<int> classCount;
+
+	void calculateMeans();
+	void calculateScatters();
+	void solveEigenProblem();
+};
@@ -1,5 +1,166 @@
 #include "linearegression.h"
 
+//Partial sums of a block of samples, the blocks are summed in order
+struct GradientPart
+{
+	Mat gradient;
+	double loss = 0.0;
+};
+
+struct GramPart
+{
+	Mat XX;
+	Mat TX;
+	Mat TT;
+};
+
+static GradientPart addParts(GradientPart lhs, const GradientPart & rhs)
+{
+	if (lhs.gradient.empty())
+		return rhs;
+
+	lhs.gradient += rhs.gradient;
+	lhs.loss += rhs.loss;
+	return lhs;
+}
+
+static GramPart addGramParts(GramPart lhs, const GramPart & rhs)
+{
+	if (lhs.XX.empty())
+		return rhs;
+
+	lhs.XX += rhs.XX;
+	lhs.TX += rhs.TX;
+	lhs.TT += rhs.TT;
+	return lhs;
+}
+
+//Residual and gradient of the samples [first, last), the samples are rows
+class GradientBody
+{
+public:
+	GradientBody(const Mat & d, const Mat & t, const Mat & p) :
+		data(d), targets(t), parameters(p) {}
+
+	GradientPart operator() (int first, int last) const
+	{
+		Mat X = data.rowRange(first, last);
+
+		//residual = T - X*W', gradient = residual'*X. The residual lives
+		//in the arena of the thread, only the gradient is handed back
+		Scratch::Frame frame;
+		GradientPart part;
+		Mat residual = frame.take(X.rows, targets.cols);
+		cv::gemm(X, parameters, -1.0, targets.rowRange(first, last), 1.0, residual, cv::GEMM_2_T);
+		cv::gemm(residual, X, 1.0, cv::noArray(), 0.0, part.gradient, cv::GEMM_1_T);
+		part.loss = residual.dot(residual);
+
+		return part;
+	}
+
+private:
+	const Mat & data;
+	const Mat & targets;
+	const Mat & parameters;
+};
+
+//Accumulating X'*X, T'*X and T'*T of the samples [first, last)
+class GramBody
+{
+public:
+	GramBody(const Mat & d, const Mat & t) : data(d), targets(t) {}
+
+	GramPart operator() (int first, int last) const
+	{
+		Mat X = data.rowRange(first, last);
+		Mat T = targets.rowRange(first, last);
+
+		GramPart part;
+		cv::mulTransposed(X, part.XX, true);
+		cv::gemm(T, X, 1.0, cv::noArray(), 0.0, part.TX, cv::GEMM_1_T);
+		cv::mulTransposed(T, part.TT, true);
+
+		return part;
+	}
+
+private:
+	const Mat & data;
+	const Mat & targets;
+};
+
+//Sparse counterpart of GradientBody over a range of CSR rows
+class SparseGradientBody
+{
+public:
+	SparseGradientBody(const CsrMatrix & d, const Mat & t, const Mat & p) :
+		data(d), targets(t), parameters(p) {}
+
+	GradientPart operator() (int first, int last) const
+	{
+		GradientPart part;
+		part.gradient = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+		for (int n = first; n < last; n++)
+		{
+			for (int m = 0; m < parameters.rows; m++)
+			{
+				double residual = targets.at<double>(n, m) -
+					data.dot(n, parameters.ptr<double>(m));
+				data.axpy(n, residual, part.gradient.ptr<double>(m));
+				part.loss += residual * residual;
+			}
+		}
+
+		return part;
+	}
+
+private:
+	const CsrMatrix & data;
+	const Mat & targets;
+	const Mat & parameters;
+};
+
+//Sparse counterpart of GramBody, X'*X is built from the outer products
+//of the non-zero elements only
+class SparseGramBody
+{
+public:
+	SparseGramBody(const CsrMatrix & d, const Mat & t) : data(d), targets(t) {}
+
+	GramPart operator() (int first, int last) const
+	{
+		int m = targets.cols;
+		GramPart part;
+		part.XX = Mat::zeros(data.cols(), data.cols(), CV_64FC1);
+		part.TX = Mat::zeros(m, data.cols(), CV_64FC1);
+		part.TT = Mat::zeros(m, m, CV_64FC1);
+		for (int n = first; n < last; n++)
+		{
+			const double * valPtr = data.rowValues(n);
+			const int * idxPtr = data.rowIndices(n);
+			int nnz = data.rowNonZeros(n);
+			for (int a = 0; a < nnz; a++)
+			{
+				double * gramPtr = part.XX.ptr<double>(idxPtr[a]);
+				for (int b = 0; b < nnz; b++)
+					gramPtr[idxPtr[b]] += valPtr[a] * valPtr[b];
+			}
+
+			for (int i = 0; i < m; i++)
+			{
+				double t = targets.at<double>(n, i);
+				data.axpy(n, t, part.TX.ptr<double>(i));
+				for (int j = 0; j < m; j++)
+					part.TT.at<double>(i, j) += t * targets.at<double>(n, j);
+			}
+		}
+
+		return part;
+	}
+
+private:
+	const CsrMatrix & data;
+	const Mat & targets;
+};
 
 bool LinearRegression::train(MethodType type)
 {
@@ -12,6 +173,9 @@ bool LinearRegression::train(MethodType type)
 	case LinearRegression::RANDOM:
 		isCompleted = trainRandom();
 		break;
+	case LinearRegression::REGULATION:
+		isCompleted = trainRegulation();
+		break;
 	default:
 		break;
 	}
@@ -19,60 +183,374 @@ bool LinearRegression::train(MethodType type)
 	return isCompleted;
 }
 
+//Returns the N*M predictions of the rows, flattened row by row
 vector<double> LinearRegression::predict(Mat & newData)
 {
+	if (newData.cols != parameters.cols)
+		throw std::exception("Invalid input data!");
+
 	Mat tmpMat;
-	tmpMat = parameters * newData;
-	
+	cv::gemm(newData, parameters, 1.0, cv::noArray(), 0.0, tmpMat, cv::GEMM_2_T);
+
+	return (vector<double>)(tmpMat.reshape(1, 1));
+}
+
+//Returns the N*M predictions of the sparse rows, flattened row by row
+vector<double> LinearRegression::predict(const CsrMatrix & newData)
+{
+	Mat tmpMat = newData.multiplyTransposed(parameters);
+
 	return (vector<double>)(tmpMat.reshape(1, 1));
 }
 
 bool LinearRegression::trainNormal()
 {
 	int curIter = 0;
+	Mat gradient;
 	while (curIter < iters)
 	{
-		Mat tmpMat(parameters.cols, parameters.rows, CV_64FC1);
-		for (int i = 0; i < data.cols; i++)
-		{
-			tmpMat += (targets.col(i) - parameters * data.col(i)) * data.col(i).t();
-		}
-
-		tmpMat = tmpMat * (alpha/data.cols);
-		parameters = parameters * (1-alpha*lambda) + tmpMat;
-
-		auto error = calculateCostFunction();
+		//The loss comes from the same residual as the gradient
+		auto error = calculateGradient(gradient);
+		errors.push_back(error);
 		if (error < elipson)
 			break;
 
+		cv::addWeighted(parameters, 1 - alpha*lambda,
+			gradient, alpha / numOfSamples(), 0.0, parameters);
+
 		curIter++;
 	}
 
 	return curIter == iters ? false : true;
 }
 
+//Mini-batch SGD over shuffled epochs. The loss of every epoch is estimated
+//from the residuals of its mini-batches, so no extra pass is needed
 bool LinearRegression::trainRandom()
 {
-	std::default_random_engine e;
-	std::uniform_int_distribution<> u(0, data.cols - 1);
+	if (isSparse())
+		return trainRandomSparse();
 
-	Mat tmpMat(parameters.cols, parameters.rows, CV_64FC1);
+	int n = data.rows;
+	if (n == 0)
+		return false;
 
-	int index = 0;
-	for (; index < data.cols; index++)
+	std::default_random_engine e(seed);
+	vector<int> order(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+
+	int b = std::min(batchSize, n);
+	Mat batchData(b, data.cols, CV_64FC1);
+	Mat batchTargets(b, targets.cols, CV_64FC1);
+	Mat residual, gradient;
+	resetOptimizer();
+
+	for (int epoch = 0; epoch < iters; epoch++)
 	{
-		auto randomVal = u(e);
+		std::shuffle(order.begin(), order.end(), e);
 
-		tmpMat = (targets.col(randomVal) - parameters * data.col(randomVal)) * data.col(randomVal).t();
-		tmpMat = tmpMat * alpha;
-		parameters = parameters * (1 - alpha*lambda) + tmpMat;
+		double epochLoss = 0.0;
+		for (int start = 0; start < n; start += b)
+		{
+			//Gathering the shuffled samples into contiguous batch buffers
+			int size = std::min(b, n - start);
+			for (int j = 0; j < size; j++)
+			{
+				Mat dataRow = batchData.row(j);
+				Mat targetRow = batchTargets.row(j);
+				data.row(order[start + j]).copyTo(dataRow);
+				targets.row(order[start + j]).copyTo(targetRow);
+			}
+			Mat X = batchData.rowRange(0, size);
+			Mat T = batchTargets.rowRange(0, size);
 
-		auto error = calculateCostFunction();
-		if (error < elipson)
-			break;
+			//residual = T - X*W', the descent direction is residual'*X/size - lambda*W
+			cv::gemm(X, parameters, -1.0, T, 1.0, residual, cv::GEMM_2_T);
+			cv::gemm(residual, X, 1.0 / size, parameters, -lambda, gradient, cv::GEMM_1_T);
+			epochLoss += residual.dot(residual);
+
+			applyStep(gradient);
+		}
+
+		epochLoss *= 0.5;
+		errors.push_back(epochLoss);
+		if (epochLoss < elipson)
+			return true;
+	}
+
+	return false;
+}
+
+//One optimizer step on a batch of row samples, for data sets streamed from
+//disk. The optimizer state is kept between calls. Returns the batch loss
+double LinearRegression::partialFit(const Mat & batchData, const Mat & batchTargets)
+{
+	if (batchData.rows != batchTargets.rows || batchData.cols != parameters.cols ||
+		batchTargets.cols != parameters.rows)
+		throw std::exception("Invalid train data!");
+	if (batchData.rows == 0)
+		return 0.0;
+	if (velocity.empty())
+		resetOptimizer();
+
+	Mat residual, gradient;
+	cv::gemm(batchData, parameters, -1.0, batchTargets, 1.0, residual, cv::GEMM_2_T);
+	cv::gemm(residual, batchData, 1.0 / batchData.rows, parameters, -lambda, gradient, cv::GEMM_1_T);
+	applyStep(gradient);
+
+	double loss = 0.5 * residual.dot(residual);
+	errors.push_back(loss);
+	return loss;
+}
+
+void LinearRegression::resetOptimizer()
+{
+	velocity = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+	squares = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+	beta1Pow = 1.0;
+	beta2Pow = 1.0;
+}
+
+//Moving the parameters along the descent direction with the chosen optimizer
+void LinearRegression::applyStep(const Mat & gradient)
+{
+	switch (optimizer)
+	{
+	case LinearRegression::MOMENTUM:
+		velocity = beta1 * velocity + gradient;
+		parameters += alpha * velocity;
+		break;
+	case LinearRegression::ADAM:
+	{
+		//Both moments are updated in the same pass as the parameters,
+		//so the step builds no temporary matrix
+		beta1Pow *= beta1;
+		beta2Pow *= beta2;
+		double step = alpha * std::sqrt(1 - beta2Pow) / (1 - beta1Pow);
+		for (int r = 0; r < parameters.rows; r++)
+		{
+			double * parPtr = parameters.ptr<double>(r);
+			double * mPtr = velocity.ptr<double>(r);
+			double * vPtr = squares.ptr<double>(r);
+			const double * gPtr = gradient.ptr<double>(r);
+			for (int c = 0; c < parameters.cols; c++)
+			{
+				mPtr[c] = beta1 * mPtr[c] + (1 - beta1) * gPtr[c];
+				vPtr[c] = beta2 * vPtr[c] + (1 - beta2) * gPtr[c] * gPtr[c];
+				parPtr[c] += step * mPtr[c] / (std::sqrt(vPtr[c]) + 1e-8);
+			}
+		}
+		break;
+	}
+	default:
+		parameters += alpha * gradient;
+		break;
 	}
-	
-	return index == data.cols ? false : true;
+}
+
+//Sparse mini-batch SGD. The gradient and the optimizer state are only
+//applied to the features present in the batch, so every step costs
+//O(M*nnz) instead of O(M*D). The ridge decay of the steps that skip a
+//feature is applied lazily: the feature records the last step it was
+//decayed for and catches up with (1 - alpha*lambda)^k when a batch touches
+//it again, and every feature catches up at the end of the epoch. This is
+//exact for plain SGD; with momentum and Adam the skipped steps decay the
+//weights without moving the optimizer state
+bool LinearRegression::trainRandomSparse()
+{
+	int n = sparseData.rows();
+	int m = parameters.rows;
+	if (n == 0)
+		return false;
+
+	std::default_random_engine e(seed);
+	vector<int> order(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+
+	int b = std::min(batchSize, n);
+	Mat gradient = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+	vector<int> stamps(parameters.cols, -1);
+	vector<int> decayed(parameters.cols, 0);
+	vector<int> touched;
+	int step = 0;
+	double decay = 1.0 - alpha * lambda;
+	resetOptimizer();
+
+	auto catchUp = [&](int col, int upTo)
+	{
+		int skipped = upTo - decayed[col];
+		if (skipped > 0 && lambda != 0.0)
+		{
+			double factor = std::pow(decay, skipped);
+			for (int r = 0; r < m; r++)
+				parameters.at<double>(r, col) *= factor;
+		}
+		decayed[col] = upTo;
+	};
+
+	for (int epoch = 0; epoch < iters; epoch++)
+	{
+		std::shuffle(order.begin(), order.end(), e);
+
+		double epochLoss = 0.0;
+		for (int start = 0; start < n; start += b, step++)
+		{
+			int size = std::min(b, n - start);
+
+			//Clearing the gradient of the columns touched by this batch
+			touched.clear();
+			for (int j = 0; j < size; j++)
+			{
+				int index = order[start + j];
+				const int * idxPtr = sparseData.rowIndices(index);
+				for (int k = 0; k < sparseData.rowNonZeros(index); k++)
+				{
+					int col = idxPtr[k];
+					if (stamps[col] == step)
+						continue;
+
+					stamps[col] = step;
+					touched.push_back(col);
+					for (int r = 0; r < m; r++)
+						gradient.at<double>(r, col) = 0.0;
+
+					//The decay of this step is part of its gradient
+					catchUp(col, step);
+					decayed[col] = step + 1;
+				}
+			}
+
+			for (int j = 0; j < size; j++)
+			{
+				int index = order[start + j];
+				for (int r = 0; r < m; r++)
+				{
+					double residual = targets.at<double>(index, r) -
+						sparseData.dot(index, parameters.ptr<double>(r));
+					sparseData.axpy(index, residual / size, gradient.ptr<double>(r));
+					epochLoss += residual * residual;
+				}
+			}
+
+			beta1Pow *= beta1;
+			beta2Pow *= beta2;
+			double adamStep = alpha * std::sqrt(1 - beta2Pow) / (1 - beta1Pow);
+			for (auto col : touched)
+			{
+				for (int r = 0; r < m; r++)
+				{
+					double & par = parameters.at<double>(r, col);
+					double g = gradient.at<double>(r, col) - lambda * par;
+					switch (optimizer)
+					{
+					case LinearRegression::MOMENTUM:
+					{
+						double & v = velocity.at<double>(r, col);
+						v = beta1 * v + g;
+						par += alpha * v;
+						break;
+					}
+					case LinearRegression::ADAM:
+					{
+						double & v = velocity.at<double>(r, col);
+						double & sq = squares.at<double>(r, col);
+						v = beta1 * v + (1 - beta1) * g;
+						sq = beta2 * sq + (1 - beta2) * g * g;
+						par += adamStep * v / (std::sqrt(sq) + 1e-8);
+						break;
+					}
+					default:
+						par += alpha * g;
+						break;
+					}
+				}
+			}
+		}
+
+		for (int col = 0; col < parameters.cols; col++)
+			catchUp(col, step);
+
+		epochLoss *= 0.5;
+		errors.push_back(epochLoss);
+		if (epochLoss < elipson)
+			return true;
+	}
+
+	return false;
+}
+
+//Ridge regression solved directly, minimizing the same loss as trainNormal:
+//(X'*X + N*lambda*I) * W' = X'*T
+bool LinearRegression::trainRegulation()
+{
+	if (numOfSamples() == 0)
+		return false;
+
+	switch (solver)
+	{
+	case LinearRegression::QR:
+		return solveQR();
+	default:
+		return solveCholesky();
+	}
+}
+
+bool LinearRegression::solveCholesky()
+{
+	//Forming the normal equations in one blocked pass over the data
+	GramPart part;
+	if (isSparse())
+		part = Executor::global().parallelReduce(0, numOfSamples(), GramPart(),
+			SparseGramBody(sparseData, targets), addGramParts, 4096);
+	else
+		part = Executor::global().parallelReduce(0, numOfSamples(), GramPart(),
+			GramBody(data, targets), addGramParts, 4096);
+
+	Mat gram = part.XX, cross = part.TX, outer = part.TT;
+	Mat A = gram + (numOfSamples() * lambda) * Mat::eye(gram.rows, gram.cols, CV_64FC1);
+	Mat Wt;
+	if (!cv::solve(A, cross.t(), Wt, cv::DECOMP_CHOLESKY))
+		return false;
+	parameters = Wt.t();
+
+	//0.5*|T - X*W'|^2 = 0.5*(tr(T'*T) - 2*tr(W*X'*T) + tr(W*X'*X*W'))
+	double loss = cv::trace(outer).val[0] - 2.0 * parameters.dot(cross) +
+		parameters.dot(parameters * gram);
+	errors.push_back(0.5 * loss);
+
+	return true;
+}
+
+//Least squares on the augmented system [X; sqrt(N*lambda)*I] * W' = [T; 0],
+//which avoids squaring the condition number of X. Sparse data is densified
+bool LinearRegression::solveQR()
+{
+	int n = numOfSamples();
+	int d = numOfFeatures();
+	Mat A = Mat::zeros(n + d, d, CV_64FC1);
+	Mat B = Mat::zeros(n + d, targets.cols, CV_64FC1);
+	Mat top = A.rowRange(0, n);
+	Mat bottom = A.rowRange(n, n + d);
+	Mat rhs = B.rowRange(0, n);
+	if (isSparse())
+		sparseData.toDense().copyTo(top);
+	else
+		data.copyTo(top);
+	targets.copyTo(rhs);
+	Mat ridge = std::sqrt(n * lambda) * Mat::eye(d, d, CV_64FC1);
+	ridge.copyTo(bottom);
+
+	Mat Wt;
+	if (!cv::solve(A, B, Wt, cv::DECOMP_QR))
+		return false;
+	parameters = Wt.t();
+
+	Mat residual = rhs - top * Wt;
+	errors.push_back(0.5 * residual.dot(residual));
+
+	return true;
 }
 
 Mat & LinearRegression::showParameters()
@@ -85,19 +563,17 @@ vector<double>& LinearRegression::showErrors()
 	return errors;
 }
 
-double LinearRegression::calculateCostFunction()
+//Computes (T - X*W')'*X over the whole data set and returns the loss
+double LinearRegression::calculateGradient(Mat & gradient)
 {
-	Mat diff(1, 1, CV_64FC1);
-	Mat tmpMat(diffs.cols, diffs.rows, CV_64FC1);
-	for (int i = 0; i < data.cols; i++)
-	{
-		tmpMat = targets.col(i) - parameters * data.col(i);
-		diff += tmpMat.t() * tmpMat;
-	}
-
-	diff = diff * 0.5;
-	auto error = (vector<double>)(diff.reshape(1,1));
-	errors.push_back(error.front());
+	GradientPart part;
+	if (isSparse())
+		part = Executor::global().parallelReduce(0, numOfSamples(), GradientPart(),
+			SparseGradientBody(sparseData, targets, parameters), addParts, 4096);
+	else
+		part = Executor::global().parallelReduce(0, numOfSamples(), GradientPart(),
+			GradientBody(data, targets, parameters), addParts, 4096);
 
-	return error.front();
+	gradient = part.gradient;
+	return 0.5 * part.loss;
 }
\ No newline at end of file
@@ -4,6 +4,11 @@
 #include <vector>
 #include <random>
 #include <iostream>
+#include <algorithm>
+
+#include "csrmatrix.h"
+#include "executor.h"
+#include "scratch.h"
 
 using cv::Mat;
 using std::vector;
@@ -11,43 +16,124 @@ using std::vector;
 class LinearRegression 
 {
 public:
+	//Every row of dataSet and outputs is a sample, both are used without copying
 	LinearRegression(Mat & dataSet, Mat & outputs, int i = 100, double e = 0.0001, double a = 0.01)
 		try:
-			data(dataSet.t()), targets(outputs.t()), 
+			data(dataSet), targets(outputs), 
 			iters(i), elipson(e), alpha(a)
 	{
 		if (dataSet.rows != outputs.rows)
 			throw std::exception("Invalid train data!");
 
-		diffs.zeros(cv::Size(1, outputs.cols), CV_64FC1);
-		parameters.zeros(cv::Size(dataSet.cols, outputs.cols), CV_64FC1);
+		parameters = Mat::zeros(cv::Size(dataSet.cols, outputs.cols), CV_64FC1);
 	}
-	catch(const std::exception e){
-		std::cout << e.what() << std::endl;
+	catch(const std::exception ex){
+		std::cout << ex.what() << std::endl;
 		data = Mat::zeros(0, 0, CV_64FC1);
 		targets = Mat::zeros(0, 0, CV_64FC1);
 	}
 
+	//Model without a data set, trained batch by batch with partialFit
+	LinearRegression(int features, int outputs, double a = 0.01)
+		try:
+			iters(0), elipson(0.0), alpha(a)
+	{
+		if (features <= 0 || outputs <= 0)
+			throw std::exception("Invalid model size!");
+
+		parameters = Mat::zeros(cv::Size(features, outputs), CV_64FC1);
+	}
+	catch(const std::exception ex){
+		std::cout << ex.what() << std::endl;
+	}
+
+	//Every row of dataSet is a sparse sample
+	LinearRegression(const CsrMatrix & dataSet, Mat & outputs, int i = 100, double e = 0.0001, double a = 0.01)
+		try:
+			sparseData(dataSet), targets(outputs),
+			iters(i), elipson(e), alpha(a)
+	{
+		if (dataSet.rows() != outputs.rows)
+			throw std::exception("Invalid train data!");
+
+		parameters = Mat::zeros(cv::Size(dataSet.cols(), outputs.cols), CV_64FC1);
+	}
+	catch(const std::exception ex){
+		std::cout << ex.what() << std::endl;
+		targets = Mat::zeros(0, 0, CV_64FC1);
+	}
+
 	enum MethodType { NORMAL, RANDOM, REGULATION };
+	enum SolverType { CHOLESKY, QR };
+	enum OptimizerType { PLAIN, MOMENTUM, ADAM };
+
+	void setLambda(double l)
+	{
+		if (l >= 0.0)
+			lambda = l;
+	}
+	void setSolver(SolverType s)
+	{
+		solver = s;
+	}
+	void setOptimizer(OptimizerType o, double b1 = 0.9, double b2 = 0.999)
+	{
+		optimizer = o;
+		beta1 = b1;
+		beta2 = b2;
+	}
+	void setBatchSize(int b)
+	{
+		if (b > 0)
+			batchSize = b;
+	}
+	void setSeed(unsigned int s)
+	{
+		seed = s;
+	}
 
 	Mat & showParameters();
 	vector<double> & showErrors();
 	bool train(MethodType type);
+	double partialFit(const Mat & batchData, const Mat & batchTargets);
 	vector<double> predict(Mat & newData);
+	vector<double> predict(const CsrMatrix & newData);
 	
 private:
 	int iters;
 	double elipson;
 	double alpha;
 	double lambda = 2.5;
+	SolverType solver = CHOLESKY;
+
+	//SGD settings, iters is the number of epochs for RANDOM
+	OptimizerType optimizer = PLAIN;
+	int batchSize = 32;
+	double beta1 = 0.9;
+	double beta2 = 0.999;
+	unsigned int seed = 0;
+	Mat velocity;
+	Mat squares;
+	double beta1Pow = 1.0;
+	double beta2Pow = 1.0;
 	vector<double> errors;
 
 	Mat data;
+	CsrMatrix sparseData;
 	Mat targets;
-	Mat diffs;
 	Mat parameters;
 
+	bool isSparse() const { return !sparseData.empty(); }
+	int numOfSamples() const { return isSparse() ? sparseData.rows() : data.rows; }
+	int numOfFeatures() const { return isSparse() ? sparseData.cols() : data.cols; }
+
 	bool trainNormal();
 	bool trainRandom();
-	double calculateCostFunction();
+	bool trainRandomSparse();
+	bool trainRegulation();
+	bool solveCholesky();
+	bool solveQR();
+	void resetOptimizer();
+	void applyStep(const Mat & gradient);
+	double calculateGradient(Mat & gradient);
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "mappedfile.h"
+
+#include <exception>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string & path) :
+	address(nullptr), length(0), file(INVALID_HANDLE_VALUE), map(nullptr)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::exception("Cannot open the file!");
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		release();
+		throw std::exception("Cannot open the file!");
+	}
+	length = static_cast<size_t>(size.QuadPart);
+
+	//Empty files cannot be mapped
+	if (length == 0)
+		return;
+
+	map = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (map)
+		address = static_cast<char *>(MapViewOfFile(map, FILE_MAP_COPY, 0, 0, 0));
+	if (!address)
+	{
+		release();
+		throw std::exception("Cannot map the file!");
+	}
+}
+
+void MappedFile::release()
+{
+	if (address)
+		UnmapViewOfFile(address);
+	if (map)
+		CloseHandle(map);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+#else
+MappedFile::MappedFile(const std::string & path) :
+	address(nullptr), length(0)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::exception("Cannot open the file!");
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		throw std::exception("Cannot open the file!");
+	}
+	length = static_cast<size_t>(info.st_size);
+
+	//Empty files cannot be mapped, and the descriptor is not needed once
+	//the mapping exists
+	void * ptr = length ?
+		mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : nullptr;
+	close(fd);
+	if (ptr == MAP_FAILED)
+		throw std::exception("Cannot map the file!");
+
+	address = static_cast<char *>(ptr);
+	if (address)
+		madvise(address, length, MADV_SEQUENTIAL);
+}
+
+void MappedFile::release()
+{
+	if (address)
+		munmap(address, length);
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+	release();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+//Whole file mapped into memory. The mapping is copy-on-write, so the pages
+//may be modified without ever touching the file.
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string & path);
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator= (const MappedFile &) = delete;
+	~MappedFile();
+
+	char * data() const { return address; }
+	size_t size() const { return length; }
+
+private:
+	char * address;
+	size_t length;
+#ifdef _WIN32
+	void * file;
+	void * map;
+#endif
+
+	void release();
+};
@@ -0,0 +1,184 @@
+#include "mlbase.h"
+
+#include <cfloat>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+//дʱļ滻ԭļдʱжҲԭļ
+//filesystem::renameĿʱԭӵ滻
+static void replaceFile(const std::string & path, const std::string & content)
+{
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write(content.data(), content.size());
+		if (!out)
+			throw std::exception("Can not write the checkpoint!");
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec)
+		throw std::exception("Can not write the checkpoint!");
+}
+
+void MLBase::setCheckpoint(const std::string & path, int every)
+{
+	if (every < 1)
+		throw std::exception("Invalid checkpoint interval!");
+
+	checkpointPath = path;
+	checkpointEvery = every;
+}
+
+//ļʽչ.xml.yml.json֤ʧСģһ
+//YAMLıpath".best"ļУûʱɾļ
+void MLBase::saveCheckpoint(const std::string & path) const
+{
+	cv::FileStorage fs(path, cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+	writeCheckpoint(fs);
+	replaceFile(path, fs.releaseAndGetString());
+
+	std::string bestPath = path + ".best";
+	if (!bestState.empty())
+		replaceFile(bestPath, bestState);
+	else
+	{
+		std::error_code ec;
+		std::filesystem::remove(bestPath, ec);
+	}
+}
+
+void MLBase::resume(const std::string & path)
+{
+	cv::FileStorage fs(path, cv::FileStorage::READ);
+	if (!fs.isOpened())
+		throw std::exception("Can not open the checkpoint!");
+
+	readCheckpoint(fs);
+	bestState.clear();
+	std::ifstream best(path + ".best", std::ios::binary);
+	if (best)
+	{
+		std::ostringstream content;
+		content << best.rdbuf();
+		bestState = content.str();
+	}
+	resumed = true;
+}
+
+void MLBase::setValidation(const cv::Mat & data, const cv::Mat & targets, int p)
+{
+	if (p < 1 || (!targets.empty() && targets.rows != data.rows))
+		throw std::exception("Invalid validation set!");
+
+	validData = data;
+	validTargets = targets;
+	patience = p;
+}
+
+void MLBase::saveState(cv::FileStorage & fs) const
+{
+	throw std::exception("Checkpoints are not supported!");
+}
+
+void MLBase::loadState(const cv::FileNode & node)
+{
+	throw std::exception("Checkpoints are not supported!");
+}
+
+double MLBase::validationLoss(const cv::Mat & data, const cv::Mat & targets) const
+{
+	throw std::exception("Validation is not supported!");
+}
+
+//Ӽָʱ֤ʧʷģ
+int MLBase::firstIteration()
+{
+	int first = 0;
+	if (resumed)
+		first = nextIteration;
+	else
+	{
+		validLosses.clear();
+		bestLoss = DBL_MAX;
+		waited = 0;
+		bestState.clear();
+	}
+
+	resumed = false;
+
+	return first;
+}
+
+bool MLBase::continueTraining(int iteration)
+{
+	nextIteration = iteration + 1;
+	bool stop = stopFlag;
+
+	if (!validData.empty())
+	{
+		double loss = validationLoss(validData, validTargets);
+		validLosses.push_back(loss);
+		if (loss < bestLoss)
+		{
+			bestLoss = loss;
+			waited = 0;
+			bestState = snapshot();
+		}
+		else if (++waited >= patience)
+			stop = true;
+	}
+
+	if (!checkpointPath.empty() &&
+		(stop || nextIteration % checkpointEvery == 0))
+		saveCheckpoint(checkpointPath);
+
+	return !stop;
+}
+
+void MLBase::finishTraining()
+{
+	if (!bestState.empty())
+	{
+		restore(bestState);
+		bestState.clear();
+	}
+	stopFlag = false;
+}
+
+void MLBase::writeCheckpoint(cv::FileStorage & fs) const
+{
+	fs << "iteration" << nextIteration;
+	fs << "bestLoss" << bestLoss;
+	fs << "waited" << waited;
+	fs << "validLosses" << validLosses;
+	fs << "state" << "{";
+	saveState(fs);
+	fs << "}";
+}
+
+void MLBase::readCheckpoint(const cv::FileStorage & fs)
+{
+	fs["iteration"] >> nextIteration;
+	fs["bestLoss"] >> bestLoss;
+	fs["waited"] >> waited;
+	fs["validLosses"] >> validLosses;
+	loadState(fs["state"]);
+}
+
+//ģͱڴеYAMLıָʱֻȡģ״̬
+std::string MLBase::snapshot() const
+{
+	cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+	writeCheckpoint(fs);
+
+	return fs.releaseAndGetString();
+}
+
+void MLBase::restore(const std::string & state)
+{
+	cv::FileStorage fs(state, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+	loadState(fs["state"]);
+}
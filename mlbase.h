@@ -1,13 +1,20 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <atomic>
 #include <opencv2\core.hpp>
 
+#include "executor.h"
+#include "telemetry.h"
+
 using std::vector;
 
 class MLBase
 {
 public:
+	virtual ~MLBase() { ; }
+
 	//ѧϰѵ
 	virtual void train() = 0;
 
@@ -18,4 +25,64 @@ public:
 	//ÿεʧֵ
 	virtual vector<double> & showLossFuncVals() = 0;
 	virtual const vector<double> & showLossFuncVals() const = 0;
-};
\ No newline at end of file
+
+	//òмõ̳߳أĬѧϰͬһ̳߳
+	void setExecutor(Executor & e) { executor = &e; }
+	Executor & getExecutor() const { return *executor; }
+
+	//ѵ̵ķֽ׶μʱصڴͳ
+	Telemetry & getTelemetry() { return telemetry; }
+	const Telemetry & getTelemetry() const { return telemetry; }
+
+	//ڵǰֹͣѵ߳е
+	void requestStop() { stopFlag = true; }
+	bool stopRequested() const { return stopFlag; }
+
+	//ÿeveryεģͺŻ״̬д㣬ѵֹͣʱҲдһ
+	void setCheckpoint(const std::string & path, int every = 1);
+	void saveCheckpoint(const std::string & path) const;
+	//ȡ֤ʧСģͣtrain()Ӽ֮ĵ
+	void resume(const std::string & path);
+
+	//ÿε֤ϵʧpatienceû½ʱǰֹͣ
+	//ѵָ֤ʧСģ͡޼ලѧϰtargets
+	void setValidation(const cv::Mat & data, const cv::Mat & targets, int patience = 5);
+	const vector<double> & showValidationLosses() const { return validLosses; }
+
+protected:
+	Executor * executor = &Executor::global();
+	Telemetry telemetry;
+
+	//еģͺŻ״ּ̬֧ѧϰĬʵ
+	virtual void saveState(cv::FileStorage & fs) const;
+	virtual void loadState(const cv::FileNode & node);
+	//֤ϵʧԽСԽ
+	virtual double validationLoss(const cv::Mat & data, const cv::Mat & targets) const;
+
+	//ѵѭĸfirstIterationصһεţͷѵʱΪ0
+	//continueTrainingÿεãfalseʱֹͣ
+	//finishTrainingѵʱ
+	int firstIteration();
+	bool continueTraining(int iteration);
+	void finishTraining();
+
+private:
+	std::atomic<bool> stopFlag{ false };
+	std::string checkpointPath;
+	int checkpointEvery = 1;
+	bool resumed = false;
+	int nextIteration = 0;
+
+	cv::Mat validData;
+	cv::Mat validTargets;
+	vector<double> validLosses;
+	double bestLoss = 0.0;
+	int patience = 0;
+	int waited = 0;
+	std::string bestState;
+
+	void writeCheckpoint(cv::FileStorage & fs) const;
+	void readCheckpoint(const cv::FileStorage & fs);
+	std::string snapshot() const;
+	void restore(const std::string & state);
+};
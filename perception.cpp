@@ -1,67 +1,270 @@
 #include "perception.h"
 
+void Perception::initParameters()
+{
+	int n = numOfSamples();
+	int d = isSparse() ? sparseData.cols() : dataSet.cols;
+	parameters = Mat::zeros(1, d + 1, CV_64FC1);
+	numOfMistakes = n;
+}
+
 void Perception::train()
 {
-	std::default_random_engine e;
-	std::uniform_int_distribution<> u(0, dataSet.cols - 1);
+	std::default_random_engine e(seed);
+	vector<int> order(numOfSamples());
+	for (int i = 0; i < numOfSamples(); i++)
+		order[i] = i;
+
+	//The voted perceptron is inherently sequential
+	if (shards > 1 && mode != VOTED)
+		trainParallel(order, e);
+	else
+		trainSerial(order, e);
+
+	omega = (vector<double>)(parameters.reshape(1, 1));
+	numOfMistakes = countMistakes();
+}
+
+void Perception::trainSerial(vector<int> & order, std::default_random_engine & e)
+{
+	//Lazy averaging: wSum collects counter*delta, so that the average is
+	//parameters - wSum/counter and every update stays O(D)
+	Mat wSum;
+	if (mode == AVERAGED)
+		wSum = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+
+	votedParameters.clear();
+	votes.clear();
+	survival = 0.0;
+
+	double counter = 1.0;
 	for (int i = 0; i < iters; i++)
 	{
-		//Is data(i) in mistake dataset
-		int randomValue = u(e);
-		if (mistakeSet.find(randomValue) == mistakeSet.end())
-			continue;
+		std::shuffle(order.begin(), order.end(), e);
 
-		//Updating parameters
-		parameters += alpha * labels.col(randomValue) * dataSet.col(randomValue).t();
-		double err = calculateErrors();
+		double err = 0.0;
+		int updates = runEpoch(order, 0, static_cast<int>(order.size()),
+			parameters, wSum, counter, err, mode == VOTED);
 		errors.push_back(err);
 
-		//If mistakeSet is empty, then tarining completed
-		if (mistakeSet.empty())
+		//A whole pass without updates means no sample is misclassified
+		if (updates == 0)
 			break;
 	}
+
+	if (mode == AVERAGED)
+		parameters = parameters - wSum / counter;
+	else if (mode == VOTED)
+	{
+		votedParameters.push_back(parameters.clone());
+		votes.push_back(survival);
+	}
 }
 
-//dataPoint must be a n*1 matrix!
-int Perception::predict(Mat & dataPoint)
+//Iterative parameter mixing: the shards are trained on threads from the
+//same weights, and the uniform mixture starts the next epoch
+void Perception::trainParallel(vector<int> & order, std::default_random_engine & e)
 {
-	Mat tmp = Mat::zeros(1, 1, CV_64FC1);
-	tmp = parameters * dataPoint;
-	auto dv = (vector<double>)(tmp.reshape(1, 1));
-	auto result = dv.front();
+	int numOfShards = std::min(shards, static_cast<int>(order.size()));
+	vector<Mat> weights(numOfShards);
+	vector<double> errs(numOfShards);
+	vector<int> updates(numOfShards);
+
+	Mat avgSum = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+	int epochs = 0;
+	for (int i = 0; i < iters; i++)
+	{
+		std::shuffle(order.begin(), order.end(), e);
+		int n = static_cast<int>(order.size());
+		Executor::global().parallelFor(0, numOfShards, [&](int first, int last)
+		{
+			//Every shard runs one epoch on its own copy of the weights
+			for (int s = first; s < last; s++)
+			{
+				Mat noSum;
+				double counter = 1.0;
+				errs[s] = 0.0;
+				weights[s] = parameters.clone();
+				updates[s] = runEpoch(order, n * s / numOfShards,
+					n * (s + 1) / numOfShards, weights[s], noSum, counter,
+					errs[s], false);
+			}
+		});
+
+		int totalUpdates = 0;
+		double err = 0.0;
+		parameters = Mat::zeros(parameters.rows, parameters.cols, CV_64FC1);
+		for (int s = 0; s < numOfShards; s++)
+		{
+			parameters += weights[s];
+			err += errs[s];
+			totalUpdates += updates[s];
+		}
+		parameters /= numOfShards;
+		errors.push_back(err);
 
-	return result >= 0 ? 1 : -1;
+		avgSum += parameters;
+		epochs++;
+		if (totalUpdates == 0)
+			break;
+	}
+
+	//The averaged mode averages the mixed weights of every epoch
+	if (mode == AVERAGED && epochs > 0)
+		parameters = avgSum / epochs;
 }
 
-bool Perception::isMistake(int index)
+//One pass over order[begin, end), every visit costs O(D), the loss is
+//collected on the way. Returns the number of updates
+int Perception::runEpoch(const vector<int> & order, int begin, int end, Mat & w,
+	Mat & wSum, double & counter, double & err, bool vote)
 {
-	Mat tmp;
-	tmp = parameters * dataSet.col(index) * labels.col(index);
-	auto tmpVector = (vector<double>)(tmp.reshape(1, 1));
-	double result = tmpVector.front();
+	int updates = 0;
+	for (int i = begin; i < end; i++, counter++)
+	{
+		int index = order[i];
+		double margin = calculateMargin(index, w);
+		if (margin > 0)
+		{
+			if (vote)
+				survival++;
+			continue;
+		}
+
+		if (vote)
+		{
+			if (survival > 0)
+			{
+				votedParameters.push_back(w.clone());
+				votes.push_back(survival);
+			}
+			survival = 1.0;
+		}
+
+		//Updating parameters
+		double step = alpha * labels.at<double>(index, 0);
+		sampleAxpy(index, step, w.ptr<double>(0));
+		if (!wSum.empty())
+			sampleAxpy(index, counter * step, wSum.ptr<double>(0));
+
+		err -= margin;
+		updates++;
+	}
 
-	return result <= 0 ? true : false;
+	return updates;
 }
 
-double Perception::calculateErrors()
+//dataPoint holds the D features as a row or a column, the bias is added
+//implicitly like in training and in the sparse predict
+int Perception::predict(Mat & dataPoint)
 {
-	Mat tmp = Mat::zeros(1, 1, CV_64FC1);
-	for (int i = 0; i < dataSet.cols; i++)
-		if (isMistake(i))
-		{
-			if (mistakeSet.find(i) == mistakeSet.end())
-				mistakeSet.insert(i);
+	if (static_cast<int>(dataPoint.total()) + 1 != parameters.cols)
+		throw std::exception("Invalid input data!");
+
+	Mat point = dataPoint;
+	if (!point.isContinuous() || point.type() != CV_64FC1)
+		dataPoint.convertTo(point, CV_64FC1);
+	const double * x = point.ptr<double>(0);
+	auto score = [&](const Mat & w)
+	{
+		const double * wPtr = w.ptr<double>(0);
+		double result = wPtr[0];
+		for (int j = 1; j < w.cols; j++)
+			result += wPtr[j] * x[j - 1];
+
+		return result;
+	};
 
-			tmp += parameters * dataSet.col(i) * labels.col(i);
+	if (mode == VOTED && !votedParameters.empty())
+	{
+		double vote = 0.0;
+		for (int k = 0; k < static_cast<int>(votes.size()); k++)
+			vote += score(votedParameters[k]) >= 0 ? votes[k] : -votes[k];
+
+		return vote >= 0 ? 1 : -1;
+	}
+
+	return score(parameters) >= 0 ? 1 : -1;
+}
+
+double Perception::calculateMargin(int index, const Mat & w) const
+{
+	return sampleDot(index, w.ptr<double>(0)) * labels.at<double>(index, 0);
+}
+
+//w[0] is the bias, w[1..D] the feature weights
+//Predicts every row of a sparse matrix, the bias is added implicitly
+vector<int> Perception::predict(const CsrMatrix & datas)
+{
+	if (datas.cols() + 1 != parameters.cols)
+		throw std::exception("Invalid input data!");
+
+	vector<int> result(datas.rows());
+	for (int i = 0; i < datas.rows(); i++)
+	{
+		if (mode == VOTED && !votedParameters.empty())
+		{
+			double vote = 0.0;
+			for (int k = 0; k < static_cast<int>(votes.size()); k++)
+			{
+				const double * w = votedParameters[k].ptr<double>(0);
+				vote += w[0] + datas.dot(i, w + 1) >= 0 ? votes[k] : -votes[k];
+			}
+			result[i] = vote >= 0 ? 1 : -1;
 		}
 		else
-			if (mistakeSet.find(i) != mistakeSet.end())
-				mistakeSet.erase(i);
+		{
+			const double * w = parameters.ptr<double>(0);
+			result[i] = w[0] + datas.dot(i, w + 1) >= 0 ? 1 : -1;
+		}
+	}
+
+	return result;
+}
+
+double Perception::sampleDot(int index, const double * w) const
+{
+	if (isSparse())
+		return w[0] + sparseData.dot(index, w + 1);
+
+	const double * dataPtr = dataSet.ptr<double>(index);
+	double result = w[0];
+	for (int j = 0; j < dataSet.cols; j++)
+		result += w[j + 1] * dataPtr[j];
+
+	return result;
+}
+
+void Perception::sampleAxpy(int index, double a, double * w) const
+{
+	w[0] += a;
+	if (isSparse())
+	{
+		sparseData.axpy(index, a, w + 1);
+		return;
+	}
+
+	const double * dataPtr = dataSet.ptr<double>(index);
+	for (int j = 0; j < dataSet.cols; j++)
+		w[j + 1] += a * dataPtr[j];
+}
+
+//One O(N*D) pass after training, the weights change after every visit, so
+//the margins seen during an epoch do not tell the final mistakes
+int Perception::countMistakes() const
+{
+	auto partial = [&](int first, int last)
+	{
+		int count = 0;
+		for (int i = first; i < last; i++)
+			if (calculateMargin(i, parameters) <= 0)
+				count++;
 
-	tmp = -1.0 * tmp;
-	auto tmpVector = (vector<double>)(tmp.reshape(1, 1));
+		return count;
+	};
 
-	return tmpVector.front();
+	return Executor::global().parallelReduce(0, numOfSamples(), 0,
+		partial, std::plus<int>(), 1024);
 }
 
 vector<double> Perception::showParameters()
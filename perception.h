@@ -1,56 +1,106 @@
 #pragma once
 
 #include <opencv2\opencv.hpp>
-#include <set>
 #include <vector>
 #include <iostream>
 #include <random>
+#include <algorithm>
+
+#include "csrmatrix.h"
+#include "executor.h"
 
 using cv::Mat;
 using std::cout;
 using std::endl;
 using std::vector;
-using std::set;
 
 class Perception 
 {
 public:
+	enum Mode { VANILLA, AVERAGED, VOTED };
+
+	//i is the maximum number of passes over the data set
 	Perception(Mat & l, Mat & d, double a = 0.01, int i = 2000) try: 
-		labels(l.t()), alpha(a), iters(i)
+		labels(l), dataSet(d), alpha(a), iters(i)
 	{
 		if (l.rows != d.rows)
 			throw std::exception("Invalid input data!");
 
-		Mat bias(l.rows, 1, CV_64FC1, cv::Scalar(1));
-		cv::hconcat(bias, d, dataSet);
-		dataSet = dataSet.t();
+		initParameters();
+	}
+	catch (const std::exception& e)
+	{
+		cout << e.what() << endl;
+	}
+
+	//Every row of d is a sparse sample, the bias is handled implicitly
+	Perception(Mat & l, const CsrMatrix & d, double a = 0.01, int i = 2000) try:
+		labels(l), sparseData(d), alpha(a), iters(i)
+	{
+		if (l.rows != d.rows())
+			throw std::exception("Invalid input data!");
 
-		parameters = Mat::zeros(1, dataSet.cols, CV_64FC1);
-		for (int i = 0; i < l.rows; i++)
-			mistakeSet.insert(i);
+		initParameters();
 	}
 	catch (const std::exception& e)
 	{
 		cout << e.what() << endl;
 	}
 
+	void setMode(Mode m)
+	{
+		mode = m;
+	}
+	void setShards(int s)
+	{
+		if (s >= 1)
+			shards = s;
+	}
+	void setSeed(unsigned int s)
+	{
+		seed = s;
+	}
+
 	void train();
 	int predict(Mat & dataPoint);
+	vector<int> predict(const CsrMatrix & datas);
 	vector<double> showParameters();
 	vector<double> showErrors();
+	//Training samples misclassified by the final weight vector
+	int showNumOfMistakes() const { return numOfMistakes; }
 
 private:
+	//parameters[0] is the bias, the samples themselves carry no bias column
 	Mat labels;
 	Mat dataSet;
+	CsrMatrix sparseData;
 	Mat parameters;
 
 	int iters;
 	double alpha;
+	Mode mode = VANILLA;
+	int shards = 1;
+	unsigned int seed = 0;
+
+	//Weight vectors and survival counts of the voted perceptron
+	vector<Mat> votedParameters;
+	vector<double> votes;
+	double survival;
+
+	int numOfMistakes;
 
-	set<int> mistakeSet;
 	vector<double> omega;
 	vector<double> errors;
 
-	bool isMistake(int index);
-	double calculateErrors();
+	void initParameters();
+	bool isSparse() const { return !sparseData.empty(); }
+	int numOfSamples() const { return isSparse() ? sparseData.rows() : dataSet.rows; }
+	double sampleDot(int index, const double * w) const;
+	void sampleAxpy(int index, double a, double * w) const;
+	void trainSerial(vector<int> & order, std::default_random_engine & e);
+	void trainParallel(vector<int> & order, std::default_random_engine & e);
+	int runEpoch(const vector<int> & order, int begin, int end, Mat & w,
+		Mat & wSum, double & counter, double & err, bool vote);
+	double calculateMargin(int index, const Mat & w) const;
+	int countMistakes() const;
 };
\ No newline at end of file
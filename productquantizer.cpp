@@ -0,0 +1,211 @@
+#include "productquantizer.h"
+
+ProductQuantizer::ProductQuantizer(int subspaces, int centroids, int i) :
+	M(subspaces), K(centroids), iters(i), offsets(1, 0)
+{
+	if (M < 1 || K < 2 || K > 256 || iters < 1)
+		throw std::exception("Invalid parameters!");
+}
+
+//The first D%M subspaces hold one feature more than the others
+void ProductQuantizer::train(const Mat & datas)
+{
+	if (datas.cols < M || datas.rows < K)
+		throw std::exception("Invalid input data!");
+
+	offsets.assign(M + 1, 0);
+	for (int m = 0; m < M; m++)
+		offsets[m + 1] = offsets[m] + datas.cols / M + (m < datas.cols % M ? 1 : 0);
+
+	codebooks.assign(M, Mat());
+	centroidNorms.assign(M, Mat());
+	executor->parallelFor(0, M, [&](int first, int last)
+	{
+		for (int m = first; m < last; m++)
+		{
+			Mat sub;
+			datas.colRange(offsets[m], offsets[m + 1]).copyTo(sub);
+
+			Kmeans k(sub, K, 0.0, iters);
+			k.setExecutor(*executor);
+			k.train();
+			k.showMeans().copyTo(codebooks[m]);
+
+			//||c||^2 of every centroid, used by the GEMM assignment of encode
+			Mat norms(1, K, CV_64FC1);
+			for (int c = 0; c < K; c++)
+				norms.at<double>(0, c) = codebooks[m].row(c).dot(codebooks[m].row(c));
+			centroidNorms[m] = norms;
+		}
+	});
+}
+
+void ProductQuantizer::checkTrained(int cols) const
+{
+	if (codebooks.empty())
+		throw std::exception("The quantizer is not trained!");
+	if (cols != numOfFeatures())
+		throw std::exception("Invalid input data!");
+}
+
+//Every block of rows is assigned with one GEMM per subspace:
+//||x-c||^2 = ||x||^2 - 2x*c' + ||c||^2 and ||x||^2 does not change the argmin.
+//The blocks have a fixed number of rows, so the scores stay blockRows*K
+//whatever the chunk of a worker
+Mat ProductQuantizer::encode(const Mat & datas) const
+{
+	checkTrained(datas.cols);
+
+	Mat codes(datas.rows, M, CV_8UC1);
+	executor->parallelFor(0, datas.rows, [&](int first, int last)
+	{
+		Scratch::Frame frame;
+		Mat buffer = frame.take(std::min(last - first, Scratch::blockRows), K);
+		for (int begin = first; begin < last; begin += Scratch::blockRows)
+		{
+			int end = std::min(begin + Scratch::blockRows, last);
+			Mat scores = buffer.rowRange(0, end - begin);
+			for (int m = 0; m < M; m++)
+			{
+				Mat block = datas(cv::Range(begin, end), cv::Range(offsets[m], offsets[m + 1]));
+				cv::gemm(block, codebooks[m], -2.0, cv::noArray(), 0.0, scores, cv::GEMM_2_T);
+
+				const double * normPtr = centroidNorms[m].ptr<double>(0);
+				for (int i = 0; i < scores.rows; i++)
+				{
+					const double * scorePtr = scores.ptr<double>(i);
+					int best = 0;
+					double minDist = scorePtr[0] + normPtr[0];
+					for (int c = 1; c < K; c++)
+					{
+						double curDist = scorePtr[c] + normPtr[c];
+						if (curDist < minDist)
+						{
+							best = c;
+							minDist = curDist;
+						}
+					}
+					codes.at<uchar>(begin + i, m) = static_cast<uchar>(best);
+				}
+			}
+		}
+	}, 256);
+
+	return codes;
+}
+
+Mat ProductQuantizer::decode(const Mat & codes) const
+{
+	if (codebooks.empty() || codes.cols != M || codes.type() != CV_8UC1)
+		throw std::exception("Invalid codes!");
+
+	Mat datas(codes.rows, numOfFeatures(), CV_64FC1);
+	executor->parallelFor(0, codes.rows, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			const uchar * codePtr = codes.ptr<uchar>(i);
+			for (int m = 0; m < M; m++)
+			{
+				Mat sub = datas.row(i).colRange(offsets[m], offsets[m + 1]);
+				codebooks[m].row(codePtr[m]).copyTo(sub);
+			}
+		}
+	}, 1024);
+
+	return datas;
+}
+
+Mat ProductQuantizer::distanceTable(const Mat & query) const
+{
+	checkTrained(query.cols);
+	if (query.rows != 1)
+		throw std::exception("Invalid query!");
+
+	Mat table(M, K, CV_64FC1);
+	for (int m = 0; m < M; m++)
+	{
+		Mat sub = query.colRange(offsets[m], offsets[m + 1]);
+		double * tablePtr = table.ptr<double>(m);
+		for (int c = 0; c < K; c++)
+			tablePtr[c] = cv::norm(sub, codebooks[m].row(c), cv::NORM_L2SQR);
+	}
+
+	return table;
+}
+
+//The scan only reads the codes and a table that stays in the cache, so it
+//runs at the speed the codes can be streamed from memory
+void ProductQuantizer::lookUp(const Mat & table, const Mat & codes,
+	int first, int last, double * dists) const
+{
+	for (int i = first; i < last; i++)
+	{
+		const uchar * codePtr = codes.ptr<uchar>(i);
+		double dist = 0.0;
+		for (int m = 0; m < M; m++)
+			dist += table.at<double>(m, codePtr[m]);
+		dists[i - first] = dist;
+	}
+}
+
+Mat ProductQuantizer::distances(const Mat & query, const Mat & codes) const
+{
+	if (codes.cols != M || codes.type() != CV_8UC1)
+		throw std::exception("Invalid codes!");
+
+	Mat table = distanceTable(query);
+	Mat dists(codes.rows, 1, CV_64FC1);
+	executor->parallelFor(0, codes.rows, [&](int first, int last)
+	{
+		lookUp(table, codes, first, last, dists.ptr<double>(first));
+	}, 4096);
+
+	return dists;
+}
+
+//Every block keeps its own k best codes, the blocks are merged in order
+vector<std::pair<double, int>> ProductQuantizer::search(const Mat & query,
+	const Mat & codes, int k) const
+{
+	if (codes.cols != M || codes.type() != CV_8UC1 || k < 1)
+		throw std::exception("Invalid codes!");
+
+	typedef vector<std::pair<double, int>> Candidates;
+	Mat table = distanceTable(query);
+	auto keepBest = [k](Candidates & candidates)
+	{
+		if (static_cast<int>(candidates.size()) > k)
+		{
+			std::nth_element(candidates.begin(), candidates.begin() + k, candidates.end());
+			candidates.resize(k);
+		}
+	};
+
+	auto partialSearch = [&](int first, int last)
+	{
+		vector<double> dists(last - first);
+		lookUp(table, codes, first, last, dists.data());
+
+		Candidates candidates;
+		candidates.reserve(dists.size());
+		for (int i = first; i < last; i++)
+			candidates.push_back(std::make_pair(dists[i - first], i));
+		keepBest(candidates);
+
+		return candidates;
+	};
+
+	auto merge = [&](Candidates lhs, const Candidates & rhs)
+	{
+		lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+		keepBest(lhs);
+		return lhs;
+	};
+
+	Candidates result = executor->parallelReduce(0, codes.rows, Candidates(),
+		partialSearch, merge, 4096);
+	std::sort(result.begin(), result.end());
+
+	return result;
+}
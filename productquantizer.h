@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <opencv2\core.hpp>
+
+#include "kmeans.h"
+#include "scratch.h"
+
+using cv::Mat;
+using std::vector;
+
+//Product quantizer: the D features are split into M subspaces and one
+//Kmeans codebook of at most 256 centroids is learned per subspace, so a
+//sample is stored as M bytes. Queries are compared against the codes with
+//asymmetric distances: a M*K table of the squared distances between the
+//query and every centroid turns the distance to a code into M lookups.
+class ProductQuantizer
+{
+public:
+	explicit ProductQuantizer(int subspaces, int centroids = 256, int iters = 25);
+
+	void setExecutor(Executor & e) { executor = &e; }
+
+	//datas is N*D, every row is a sample. The subspaces are trained in parallel
+	void train(const Mat & datas);
+
+	//N*D samples to N*M codes of type CV_8UC1, and back
+	Mat encode(const Mat & datas) const;
+	Mat decode(const Mat & codes) const;
+
+	//M*K squared distances between the subspaces of a 1*D query and the centroids
+	Mat distanceTable(const Mat & query) const;
+	//N*1 asymmetric squared distances between a query and all the codes
+	Mat distances(const Mat & query, const Mat & codes) const;
+	//The k codes closest to a query, sorted by distance
+	vector<std::pair<double, int>> search(const Mat & query, const Mat & codes, int k) const;
+
+	int numOfSubspaces() const { return M; }
+	int numOfCentroids() const { return K; }
+	int numOfFeatures() const { return offsets.back(); }
+	const Mat & codebook(int m) const { return codebooks[m]; }
+
+private:
+	int M;
+	int K;
+	int iters;
+	Executor * executor = &Executor::global();
+
+	//Subspace m holds the features [offsets[m], offsets[m+1])
+	vector<int> offsets;
+	vector<Mat> codebooks;
+	vector<Mat> centroidNorms;
+
+	void checkTrained(int cols) const;
+	void lookUp(const Mat & table, const Mat & codes, int first, int last,
+		double * dists) const;
+};
@@ -2,10 +2,10 @@
 
 Relief::Relief(Mat & l, Mat & d, unsigned int num, double t) 
 try:
-	labels(l.t()), dataSet(d.t()),
+	labels(l), dataSet(d),
 	threshold(t), numberOfSample(num)
 {
-	if (l.cols != d.cols)
+	if (l.rows != d.rows)
 		throw std::exception("Invalid input data!");
 
 	features = Mat::zeros(numberOfSample, 1, CV_64FC1);
@@ -14,12 +14,15 @@ try:
 	for (int i = 0; i < weightsVector.size(); i++)
 		weightsVector[i] = 0.0;
 
-	vector<int> tmpVec = (vector<int>)(l.reshape(1, 1));
-	for (auto ele : tmpVec)
-		if (ele == 0)
-			class1.push_back(ele);
-		else if (ele == 1)
-			class2.push_back(ele);
+	//Converting also makes strided label views continuous
+	Mat intLabels;
+	l.convertTo(intLabels, CV_32S);
+	vector<int> tmpVec = (vector<int>)(intLabels.reshape(1, 1));
+	for (int i = 0; i < static_cast<int>(tmpVec.size()); i++)
+		if (tmpVec[i] == 0)
+			class1.push_back(i);
+		else if (tmpVec[i] == 1)
+			class2.push_back(i);
 		else
 			throw std::exception("Invalid input data!");
 
@@ -35,67 +38,33 @@ void Relief::extractFeatures(int nf)
 		return;
 
 	std::default_random_engine e;
-	std::uniform_int_distribution<> u(0, dataSet.cols - 1);
+	std::uniform_int_distribution<> u(0, dataSet.rows - 1);
 
-	map<double, int> nearHitData;
-	map<double, int> nearMissData;
 	for (int i = 0; i < numberOfSample; i++)
 	{
 		int rand = u(e);
 		
 		//Finding near-hit datapoint and near-miss datapoint
-		nearHitData.clear();
-		nearMissData.clear();
-		if (std::find(class1.begin(), class1.end(), rand) != class1.end())
-		{
-			for (auto ele : class1)
-			{
-				if (ele != rand)
-				{
-					auto dot =
-						calculateLength(dataSet.col(rand), dataSet.col(ele));
-					nearHitData.insert(std::make_pair(dot, ele));
-				}
-			}
-
-			for (auto ele : class2)
-			{
-				auto dot = 
-					calculateLength(dataSet.col(rand), dataSet.col(ele));
-				nearMissData.insert(std::make_pair(dot, ele));
-			}
-		}
-		else
-		{
-			for (auto ele : class2)
-			{
-				if (rand != ele)
-				{
-					auto dot =
-						calculateLength(dataSet.col(rand), dataSet.col(ele));
-					nearHitData.insert(std::make_pair(dot, ele));
-				}
-			}
-
-			for (auto ele : class1)
-			{
-				auto dot = 
-					calculateLength(dataSet.col(rand), dataSet.col(ele));
-				nearMissData.insert(std::make_pair(dot, ele));
-			}
-		}
+		bool inClass1 = 
+			std::find(class1.begin(), class1.end(), rand) != class1.end();
+		auto nearHitData = findNearest(rand, inClass1 ? class1 : class2);
+		auto nearMissData = findNearest(rand, inClass1 ? class2 : class1);
 
 		//Saving near-hit datapoint's index and near-miss's index
-		int nearHit = (nearHitData.begin())->second;
-		int nearMiss = (nearMissData.begin())->second;
-		for (int i = 0; i < dataSet.rows; i++)
+		int nearHit = nearHitData.second;
+		int nearMiss = nearMissData.second;
+		//A class with a single member has no near-hit, an empty one no near-miss
+		if (nearHit < 0 || nearMiss < 0)
+			continue;
+
+		for (int i = 0; i < dataSet.cols; i++)
 		{
 			weightsVector[i] += calculateFeatureWeight(rand, nearHit, nearMiss, i);
 		}
 	}
 
 	//Using map data sturcture to find the max-nf weights
-	map<double, int, greater<int>> sortWeights;
+	map<double, int, greater<double>> sortWeights;
 	for (int i = 0; i < weightsVector.size(); i++)
 	{
 		auto ele = weightsVector[i];
@@ -121,11 +90,40 @@ vector<double> Relief::showWeights()
 
 Mat Relief::showReulst()
 {
-	return features.t();
+	return features;
+}
+
+//Returns the squared distance and the index of the candidate nearest to
+//sample index, the candidates are scanned in parallel
+pair<double, int> Relief::findNearest(int index, const vector<int> & candidates) const
+{
+	auto nearest = [&](int first, int last)
+	{
+		pair<double, int> rst(std::numeric_limits<double>::max(), -1);
+		for (int i = first; i < last; i++)
+		{
+			int ele = candidates[i];
+			if (ele == index)
+				continue;
+
+			double dot = calculateLength(dataSet.row(index), dataSet.row(ele));
+			if (dot < rst.first)
+				rst = std::make_pair(dot, ele);
+		}
+
+		return rst;
+	};
+	auto minimum = [](const pair<double, int> & lhs, const pair<double, int> & rhs)
+	{
+		return rhs.first < lhs.first ? rhs : lhs;
+	};
+
+	return Executor::global().parallelReduce(0, static_cast<int>(candidates.size()),
+		pair<double, int>(std::numeric_limits<double>::max(), -1), nearest, minimum, 256);
 }
 
 //Where v1 and v2 must have the same amount of elements
-double Relief::calculateLength(Mat & v1, Mat & v2)
+double Relief::calculateLength(const Mat & v1, const Mat & v2) const
 {
 	Mat diff = v1 - v2;
 	auto length = diff.dot(diff);
@@ -135,9 +133,9 @@ double Relief::calculateLength(Mat & v1, Mat & v2)
 
 double Relief::calculateFeatureWeight(int i, int nearHit, int nearMiss, int index)
 {
-	double XnearHit = dataSet.col(nearHit).at<double>(index, 0);
-	double XnearMiss = dataSet.col(nearMiss).at<double>(index, 0);
-	double Xi = dataSet.col(i).at<double>(index, 0);
+	double XnearHit = dataSet.at<double>(nearHit, index);
+	double XnearMiss = dataSet.at<double>(nearMiss, index);
+	double Xi = dataSet.at<double>(i, index);
 	double result = (Xi - XnearMiss)*(Xi - XnearMiss) - (Xi - XnearHit)*(Xi - XnearHit);
 
 	return result;
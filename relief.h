@@ -5,10 +5,15 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
+#include <limits>
+#include <utility>
 #include <opencv2\opencv.hpp>
 
+#include "executor.h"
+
 using std::vector;
 using std::map;
+using std::pair;
 using std::cout;
 using std::endl;
 using cv::Mat;
@@ -37,14 +42,16 @@ private:
 	unsigned int numberOfFeatures;
 	unsigned int numberOfSample;
 
-	double calculateLength(Mat & v1, Mat & v2);
+	pair<double, int> findNearest(int index, const vector<int> & candidates) const;
+	double calculateLength(const Mat & v1, const Mat & v2) const;
 	double calculateFeatureWeight(int i, int nearHit, int nearMiss, int index);
 };
 
 template <typename T>
 class greater 
 {
-	bool operator() (T & t1, T & t2)
+public:
+	bool operator() (const T & t1, const T & t2) const
 	{
 		return t1 > t2;
 	}
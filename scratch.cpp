@@ -0,0 +1,45 @@
+#include "scratch.h"
+
+#include <climits>
+
+Scratch & Scratch::local()
+{
+	static thread_local Scratch arena;
+
+	return arena;
+}
+
+size_t Scratch::capacity() const
+{
+	size_t bytes = 0;
+	for (auto & ele : buffers)
+		bytes += ele.total();
+
+	return bytes;
+}
+
+void Scratch::shrink()
+{
+	if (used != 0)
+		throw std::exception("Scratch buffers are still in use!");
+
+	buffers.clear();
+}
+
+//The buffer of a slot only grows, so after the first iteration the same
+//sequence of shapes is served without allocating. A buffer is one Mat row
+//of bytes, so larger requests than INT_MAX bytes are refused
+Mat Scratch::take(int rows, int cols, int type)
+{
+	size_t bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+	if (rows < 0 || cols < 0 || bytes > static_cast<size_t>(INT_MAX))
+		throw std::exception("Invalid scratch buffer size!");
+	if (used == buffers.size())
+		buffers.push_back(Mat());
+
+	Mat & buffer = buffers[used++];
+	if (buffer.total() < bytes)
+		buffer.create(1, static_cast<int>(bytes), CV_8UC1);
+
+	return Mat(rows, cols, type, buffer.data);
+}
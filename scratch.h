@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <opencv2\core.hpp>
+
+using cv::Mat;
+using std::vector;
+
+//Per-thread arena for the temporaries of the inner kernels. A Frame hands
+//out buffers in order and gives all of them back when it ends, so a loop
+//asking for the same shapes in every iteration only allocates in its first
+//one. The matrices do not own their memory, they must not outlive their
+//Frame and must be filled through output arguments (cv::gemm, cv::subtract,
+//copyTo, ...), assigning an expression to them allocates a new buffer.
+class Scratch
+{
+public:
+	Scratch(const Scratch &) = delete;
+	Scratch & operator= (const Scratch &) = delete;
+
+	//The arena of the calling thread
+	static Scratch & local();
+
+	//Rows of a block in the blocked GEMM kernels. A worker walks its chunk
+	//block by block, so its buffers are O(blockRows) rows whatever the chunk
+	static const int blockRows = 256;
+
+	class Frame
+	{
+	public:
+		Frame() : scratch(Scratch::local()), mark(scratch.used) {}
+		Frame(const Frame &) = delete;
+		Frame & operator= (const Frame &) = delete;
+		~Frame() { scratch.used = mark; }
+
+		//A rows*cols matrix with undefined elements
+		Mat take(int rows, int cols, int type = CV_64FC1)
+		{
+			return scratch.take(rows, cols, type);
+		}
+
+	private:
+		Scratch & scratch;
+		size_t mark;
+	};
+
+	//Bytes held by the arena of the calling thread
+	size_t capacity() const;
+	//Frees the buffers, no Frame of the thread may be alive
+	void shrink();
+
+private:
+	vector<Mat> buffers;
+	size_t used = 0;
+
+	Scratch() = default;
+	Mat take(int rows, int cols, int type);
+};
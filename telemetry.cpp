@@ -0,0 +1,150 @@
+#include "telemetry.h"
+
+#include <opencv2\core.hpp>
+
+namespace
+{
+	std::atomic<long long> allocationCount(0);
+	std::atomic<long long> allocationBytes(0);
+
+#if CV_VERSION_MAJOR >= 4
+	typedef cv::AccessFlag AccessFlags;
+#else
+	typedef int AccessFlags;
+#endif
+
+	//Forwards to the allocator it replaces and counts the new buffers.
+	//Buffers keep the forwarded allocator, so freeing costs nothing extra
+	class CountingAllocator : public cv::MatAllocator
+	{
+	public:
+		explicit CountingAllocator(cv::MatAllocator * b) : base(b) {}
+
+		cv::UMatData * allocate(int dims, const int * sizes, int type, void * data,
+			size_t * step, AccessFlags flags, cv::UMatUsageFlags usage) const override
+		{
+			cv::UMatData * u = base->allocate(dims, sizes, type, data, step, flags, usage);
+			if (u && !data)
+			{
+				allocationCount++;
+				allocationBytes += static_cast<long long>(u->size);
+			}
+
+			return u;
+		}
+		bool allocate(cv::UMatData * u, AccessFlags flags,
+			cv::UMatUsageFlags usage) const override
+		{
+			return base->allocate(u, flags, usage);
+		}
+		void deallocate(cv::UMatData * u) const override
+		{
+			base->deallocate(u);
+		}
+
+		cv::MatAllocator * base;
+	};
+}
+
+void Telemetry::beginTraining()
+{
+	reset();
+	startAllocations = allocationCount;
+	startBytes = allocationBytes;
+	trainStart = iterationStart = std::chrono::steady_clock::now();
+}
+
+void Telemetry::endIteration(double loss, long long n)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed = now - iterationStart;
+	iterationStart = now;
+
+	Iteration info = { iterations, loss, elapsed.count(), n };
+	iterations++;
+	samples += n;
+	for (auto & ele : callbacks)
+		ele(info);
+}
+
+void Telemetry::endTraining()
+{
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - trainStart;
+	totalSeconds = elapsed.count();
+	numOfAllocations = allocationCount - startAllocations;
+	numOfBytes = allocationBytes - startBytes;
+
+	if (sink)
+		exportTo(*sink, sinkPrefix);
+}
+
+void Telemetry::addPhase(Phase p, double seconds)
+{
+	phases[p].seconds += seconds;
+	phases[p].calls++;
+}
+
+double Telemetry::samplesPerSecond() const
+{
+	return totalSeconds > 0.0 ? samples / totalSeconds : 0.0;
+}
+
+void Telemetry::exportTo(MetricsSink & s, const std::string & prefix) const
+{
+	s.counter(prefix + ".iterations", iterations);
+	s.counter(prefix + ".samples", samples);
+	s.gauge(prefix + ".seconds", totalSeconds);
+	s.gauge(prefix + ".samples_per_second", samplesPerSecond());
+	s.counter(prefix + ".allocations", numOfAllocations);
+	s.counter(prefix + ".allocated_bytes", numOfBytes);
+
+	//Only the phases the learner went through
+	for (int p = 0; p < NUM_PHASES; p++)
+	{
+		if (phases[p].calls == 0)
+			continue;
+
+		std::string name = prefix + ".phase." + phaseName(static_cast<Phase>(p));
+		s.gauge(name + ".seconds", phases[p].seconds);
+		s.counter(name + ".calls", phases[p].calls);
+	}
+}
+
+void Telemetry::reset()
+{
+	for (auto & ele : phases)
+		ele = PhaseStat();
+	iterations = 0;
+	samples = 0;
+	totalSeconds = 0.0;
+	numOfAllocations = 0;
+	numOfBytes = 0;
+}
+
+//Must not be switched while matrices are being allocated by other threads.
+//The counting allocator is never freed, buffers may outlive the switch
+void Telemetry::countAllocations(bool on)
+{
+	static CountingAllocator * counting = nullptr;
+	cv::MatAllocator * current = cv::Mat::getDefaultAllocator();
+	if (on && current != counting)
+	{
+		if (!counting)
+			counting = new CountingAllocator(current);
+		counting->base = current;
+		cv::Mat::setDefaultAllocator(counting);
+	}
+	else if (!on && counting && current == counting)
+		cv::Mat::setDefaultAllocator(counting->base);
+}
+
+const char * Telemetry::phaseName(Phase p)
+{
+	static const char * names[NUM_PHASES] =
+	{
+		"assignment", "update", "estep", "mstep", "forward", "backward",
+		"kernel", "gradient", "solve", "evaluate"
+	};
+
+	return names[p];
+}
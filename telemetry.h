@@ -0,0 +1,137 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <ostream>
+#include <functional>
+
+using std::vector;
+
+//Receives the measurements of a learner, e.g. to forward them to a
+//monitoring system
+class MetricsSink
+{
+public:
+	virtual ~MetricsSink() { ; }
+
+	virtual void counter(const std::string & name, long long value) = 0;
+	virtual void gauge(const std::string & name, double value) = 0;
+};
+
+//Writes every metric as a "name value" line
+class StreamSink : public MetricsSink
+{
+public:
+	explicit StreamSink(std::ostream & o) : out(o) {}
+
+	void counter(const std::string & name, long long value) override
+	{
+		out << name << ' ' << value << '\n';
+	}
+	void gauge(const std::string & name, double value) override
+	{
+		out << name << ' ' << value << '\n';
+	}
+
+private:
+	std::ostream & out;
+};
+
+//Per-phase wall-clock timers, iteration callbacks, allocation counters and
+//throughput of one training run. The timers are taken by the thread that
+//drives the training, so a phase includes the parallel loops it waits for.
+class Telemetry
+{
+public:
+	enum Phase
+	{
+		ASSIGNMENT, UPDATE, ESTEP, MSTEP, FORWARD, BACKWARD,
+		KERNEL, GRADIENT, SOLVE, EVALUATE, NUM_PHASES
+	};
+
+	struct Iteration
+	{
+		int index;
+		double loss;
+		double seconds;
+		long long samples;
+	};
+
+	using Callback = std::function<void(const Iteration &)>;
+
+	//Adds the lifetime of the object to a phase
+	class Timer
+	{
+	public:
+		Timer(Telemetry & t, Phase p) :
+			telemetry(t), phase(p), start(std::chrono::steady_clock::now()) {}
+		Timer(const Timer &) = delete;
+		Timer & operator= (const Timer &) = delete;
+		~Timer()
+		{
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			telemetry.addPhase(phase, elapsed.count());
+		}
+
+	private:
+		Telemetry & telemetry;
+		Phase phase;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	void addCallback(Callback c) { callbacks.push_back(c); }
+	void clearCallbacks() { callbacks.clear(); }
+
+	//The sink receives all the metrics at the end of every training run
+	void setSink(MetricsSink * s, const std::string & prefix = "ml")
+	{
+		sink = s;
+		sinkPrefix = prefix;
+	}
+
+	//Called by the learners around a training run and after every iteration
+	void beginTraining();
+	void endIteration(double loss, long long samples);
+	void endTraining();
+	void addPhase(Phase p, double seconds);
+
+	double phaseSeconds(Phase p) const { return phases[p].seconds; }
+	long long phaseCalls(Phase p) const { return phases[p].calls; }
+	int numOfIterations() const { return iterations; }
+	double trainingSeconds() const { return totalSeconds; }
+	double samplesPerSecond() const;
+	long long allocations() const { return numOfAllocations; }
+	long long allocatedBytes() const { return numOfBytes; }
+
+	void exportTo(MetricsSink & s, const std::string & prefix) const;
+	void reset();
+
+	//Counting the cv::Mat allocations of the whole process, the learners
+	//report the allocations made during their training runs
+	static void countAllocations(bool on);
+	static const char * phaseName(Phase p);
+
+private:
+	struct PhaseStat
+	{
+		double seconds = 0.0;
+		long long calls = 0;
+	};
+
+	PhaseStat phases[NUM_PHASES];
+	vector<Callback> callbacks;
+	MetricsSink * sink = nullptr;
+	std::string sinkPrefix;
+
+	int iterations = 0;
+	long long samples = 0;
+	double totalSeconds = 0.0;
+	long long numOfAllocations = 0;
+	long long numOfBytes = 0;
+	long long startAllocations = 0;
+	long long startBytes = 0;
+	std::chrono::steady_clock::time_point trainStart;
+	std::chrono::steady_clock::time_point iterationStart;
+};
@@ -0,0 +1,430 @@
+#include "textreader.h"
+
+#include <charconv>
+#include <cstring>
+#include <climits>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include "executor.h"
+
+namespace
+{
+	//Calls f(first, last) for every non-empty line of [begin, end), the
+	//line breaks are excluded. Returns the number of lines
+	template <typename F>
+	int forEachLine(const char * begin, const char * end, F f)
+	{
+		int count = 0;
+		while (begin < end)
+		{
+			auto stop = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+			const char * next = stop ? stop + 1 : end;
+			if (!stop)
+				stop = end;
+			if (stop > begin && stop[-1] == '\r')
+				stop--;
+
+			if (stop > begin)
+			{
+				f(begin, stop);
+				count++;
+			}
+			begin = next;
+		}
+
+		return count;
+	}
+
+	int countLines(const char * begin, const char * end)
+	{
+		return forEachLine(begin, end, [](const char *, const char *) {});
+	}
+
+	const char * skipSpaces(const char * ptr, const char * end)
+	{
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+			ptr++;
+
+		return ptr;
+	}
+
+	const char * parseNumber(const char * ptr, const char * end, double & value)
+	{
+		if (ptr < end && *ptr == '+')
+			ptr++;
+
+		auto rst = std::from_chars(ptr, end, value);
+		if (rst.ec != std::errc())
+			throw std::exception("Invalid number!");
+
+		return rst.ptr;
+	}
+
+	//Number of index:value pairs of a LIBSVM line, comments excluded
+	int countPairs(const char * ptr, const char * end)
+	{
+		auto comment = static_cast<const char *>(std::memchr(ptr, '#', end - ptr));
+		if (comment)
+			end = comment;
+
+		return static_cast<int>(std::count(ptr, end, ':'));
+	}
+}
+
+TextReader::TextReader(const std::string & path, Format f) :
+	file(std::make_shared<MappedFile>(path)), format(f)
+{
+	position = dataBegin();
+}
+
+void TextReader::read(Mat & features, Mat & labels)
+{
+	if (format != CSV)
+		throw std::exception("Not a CSV file!");
+
+	const char * begin = dataBegin();
+	const char * end = dataEnd();
+	prepareCsv(begin, end);
+
+	//Counting the lines of every chunk, so every chunk knows its first row
+	auto bounds = splitLines(begin, end);
+	int chunks = static_cast<int>(bounds.size()) - 1;
+	vector<int> offsets(chunks + 1, 0);
+	Executor & executor = Executor::global();
+	executor.parallelFor(0, chunks, [&](int first, int last)
+	{
+		for (int c = first; c < last; c++)
+			offsets[c + 1] = countLines(bounds[c], bounds[c + 1]);
+	});
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+	int rows = offsets.back();
+	int cols = numOfColumns - (labelColumn >= 0 ? 1 : 0);
+	features.create(rows, cols, CV_64FC1);
+	if (labelColumn >= 0)
+		labels.create(rows, 1, CV_64FC1);
+	else
+		labels.release();
+
+	executor.parallelFor(0, chunks, [&](int first, int last)
+	{
+		for (int c = first; c < last; c++)
+		{
+			int row = offsets[c];
+			forEachLine(bounds[c], bounds[c + 1], [&](const char * ptr, const char * stop)
+			{
+				parseCsvLine(ptr, stop, features.ptr<double>(row),
+					labelColumn >= 0 ? labels.ptr<double>(row) : nullptr);
+				row++;
+			});
+		}
+	});
+}
+
+CsrMatrix TextReader::readSparse(Mat & labels)
+{
+	if (format != LIBSVM)
+		throw std::exception("Not a LIBSVM file!");
+
+	//Counting lines and pairs of every chunk, then every chunk writes its
+	//rows at its own offset
+	auto bounds = splitLines(dataBegin(), dataEnd());
+	int chunks = static_cast<int>(bounds.size()) - 1;
+	vector<int> rowOffsets(chunks + 1, 0);
+	vector<long long> nnzOffsets(chunks + 1, 0);
+	Executor & executor = Executor::global();
+	executor.parallelFor(0, chunks, [&](int first, int last)
+	{
+		for (int c = first; c < last; c++)
+		{
+			long long nnz = 0;
+			rowOffsets[c + 1] = forEachLine(bounds[c], bounds[c + 1],
+				[&](const char * ptr, const char * stop) { nnz += countPairs(ptr, stop); });
+			nnzOffsets[c + 1] = nnz;
+		}
+	});
+	std::partial_sum(rowOffsets.begin(), rowOffsets.end(), rowOffsets.begin());
+	std::partial_sum(nnzOffsets.begin(), nnzOffsets.end(), nnzOffsets.begin());
+	if (nnzOffsets.back() > INT_MAX)
+		throw std::exception("Too many non-zero elements!");
+
+	int rows = rowOffsets.back();
+	vector<double> values(static_cast<size_t>(nnzOffsets.back()));
+	vector<int> indices(values.size());
+	vector<int> rowPtrs(rows + 1, 0);
+	vector<int> maxIndices(chunks, 0);
+	labels.create(rows, 1, CV_64FC1);
+
+	executor.parallelFor(0, chunks, [&](int first, int last)
+	{
+		for (int c = first; c < last; c++)
+		{
+			int row = rowOffsets[c];
+			int nnz = static_cast<int>(nnzOffsets[c]);
+			forEachLine(bounds[c], bounds[c + 1], [&](const char * ptr, const char * stop)
+			{
+				int count = parseLibsvmLine(ptr, stop, values.data() + nnz,
+					indices.data() + nnz, labels.at<double>(row, 0));
+				for (int k = nnz; k < nnz + count; k++)
+					maxIndices[c] = std::max(maxIndices[c], indices[k] + 1);
+
+				nnz += count;
+				rowPtrs[++row] = nnz;
+			});
+		}
+	});
+
+	int cols = numOfFeatures;
+	if (cols == 0)
+		cols = chunks ? *std::max_element(maxIndices.begin(), maxIndices.end()) : 0;
+
+	return CsrMatrix(rows, cols, std::move(values), std::move(indices), std::move(rowPtrs));
+}
+
+bool TextReader::nextBatch(int n, Mat & features, Mat & labels)
+{
+	if (format != CSV)
+		throw std::exception("Not a CSV file!");
+
+	prepareCsv(position, dataEnd());
+	auto lines = takeLines(n);
+	int rows = static_cast<int>(lines.size() / 2);
+	if (rows == 0)
+		return false;
+
+	features.create(rows, numOfColumns - (labelColumn >= 0 ? 1 : 0), CV_64FC1);
+	if (labelColumn >= 0)
+		labels.create(rows, 1, CV_64FC1);
+	else
+		labels.release();
+
+	Executor::global().parallelFor(0, rows, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+			parseCsvLine(lines[2 * i], lines[2 * i + 1], features.ptr<double>(i),
+				labelColumn >= 0 ? labels.ptr<double>(i) : nullptr);
+	}, 256);
+
+	return true;
+}
+
+bool TextReader::nextBatch(int n, CsrMatrix & features, Mat & labels)
+{
+	if (format != LIBSVM)
+		throw std::exception("Not a LIBSVM file!");
+
+	prepareLibsvm(dataBegin(), dataEnd());
+	auto lines = takeLines(n);
+	int rows = static_cast<int>(lines.size() / 2);
+	if (rows == 0)
+		return false;
+
+	Executor & executor = Executor::global();
+	vector<int> rowPtrs(rows + 1, 0);
+	executor.parallelFor(0, rows, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+			rowPtrs[i + 1] = countPairs(lines[2 * i], lines[2 * i + 1]);
+	}, 256);
+	std::partial_sum(rowPtrs.begin(), rowPtrs.end(), rowPtrs.begin());
+
+	vector<double> values(rowPtrs.back());
+	vector<int> indices(rowPtrs.back());
+	labels.create(rows, 1, CV_64FC1);
+	executor.parallelFor(0, rows, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+			parseLibsvmLine(lines[2 * i], lines[2 * i + 1], values.data() + rowPtrs[i],
+				indices.data() + rowPtrs[i], labels.at<double>(i, 0));
+	}, 256);
+
+	features = CsrMatrix(rows, numOfFeatures, std::move(values),
+		std::move(indices), std::move(rowPtrs));
+	return true;
+}
+
+void TextReader::rewind()
+{
+	position = dataBegin();
+}
+
+//Skipping a UTF-8 byte order mark and the header line
+const char * TextReader::dataBegin() const
+{
+	const char * begin = file->data();
+	const char * end = dataEnd();
+	if (end - begin >= 3 && std::memcmp(begin, "\xEF\xBB\xBF", 3) == 0)
+		begin += 3;
+
+	if (header && format == CSV && begin < end)
+	{
+		auto stop = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+		begin = stop ? stop + 1 : end;
+	}
+
+	return begin;
+}
+
+const char * TextReader::dataEnd() const
+{
+	return file->data() + file->size();
+}
+
+//Splits [begin, end) into chunks of whole lines, a few per thread
+vector<const char *> TextReader::splitLines(const char * begin, const char * end) const
+{
+	size_t size = end - begin;
+	size_t chunks = std::min(static_cast<size_t>(Executor::global().numThreads()) * 4,
+		size / (1 << 16) + 1);
+
+	vector<const char *> bounds(1, begin);
+	for (size_t c = 1; c < chunks; c++)
+	{
+		const char * ptr = std::max(begin + size * c / chunks, bounds.back());
+		auto stop = static_cast<const char *>(std::memchr(ptr, '\n', end - ptr));
+		bounds.push_back(stop ? stop + 1 : end);
+	}
+	bounds.push_back(end);
+
+	return bounds;
+}
+
+//Returns the first and last pointers of at most n following lines
+vector<const char *> TextReader::takeLines(int n)
+{
+	vector<const char *> lines;
+	const char * end = dataEnd();
+	while (position < end && static_cast<int>(lines.size()) < 2 * n)
+	{
+		auto stop = static_cast<const char *>(std::memchr(position, '\n', end - position));
+		const char * next = stop ? stop + 1 : end;
+		if (!stop)
+			stop = end;
+		if (stop > position && stop[-1] == '\r')
+			stop--;
+
+		if (stop > position)
+		{
+			lines.push_back(position);
+			lines.push_back(stop);
+		}
+		position = next;
+	}
+
+	return lines;
+}
+
+//The number of columns comes from the first non-empty line, nothing after
+//it is scanned
+void TextReader::prepareCsv(const char * begin, const char * end)
+{
+	const char * position = begin;
+	while (numOfColumns == 0 && position < end)
+	{
+		auto stop = static_cast<const char *>(std::memchr(position, '\n', end - position));
+		const char * next = stop ? stop + 1 : end;
+		if (!stop)
+			stop = end;
+		if (stop > position && stop[-1] == '\r')
+			stop--;
+
+		if (stop > position)
+			numOfColumns = static_cast<int>(std::count(position, stop, delimiter)) + 1;
+		position = next;
+	}
+
+	if (labelColumn >= numOfColumns)
+		throw std::exception("Invalid label column!");
+}
+
+//Streamed batches must agree on the number of features, so it is taken
+//from the whole file once
+void TextReader::prepareLibsvm(const char * begin, const char * end)
+{
+	if (numOfFeatures > 0)
+		return;
+
+	auto bounds = splitLines(begin, end);
+	int chunks = static_cast<int>(bounds.size()) - 1;
+	vector<int> maxIndices(chunks, 0);
+	Executor::global().parallelFor(0, chunks, [&](int first, int last)
+	{
+		vector<double> values;
+		vector<int> indices;
+		for (int c = first; c < last; c++)
+		{
+			forEachLine(bounds[c], bounds[c + 1], [&](const char * ptr, const char * stop)
+			{
+				int count = countPairs(ptr, stop);
+				values.resize(count);
+				indices.resize(count);
+
+				double label;
+				parseLibsvmLine(ptr, stop, values.data(), indices.data(), label);
+				for (auto ele : indices)
+					maxIndices[c] = std::max(maxIndices[c], ele + 1);
+			});
+		}
+	});
+
+	numOfFeatures = chunks ? *std::max_element(maxIndices.begin(), maxIndices.end()) : 0;
+}
+
+//Empty fields are read as NaN
+void TextReader::parseCsvLine(const char * ptr, const char * end,
+	double * feats, double * label) const
+{
+	for (int c = 0; c < numOfColumns; c++)
+	{
+		auto stop = static_cast<const char *>(std::memchr(ptr, delimiter, end - ptr));
+		if (!stop)
+			stop = end;
+		if (stop == end && c != numOfColumns - 1)
+			throw std::exception("Too few CSV fields!");
+		if (stop != end && c == numOfColumns - 1)
+			throw std::exception("Too many CSV fields!");
+
+		double value = std::numeric_limits<double>::quiet_NaN();
+		const char * first = skipSpaces(ptr, stop);
+		const char * last = stop;
+		while (last > first && (last[-1] == ' ' || last[-1] == '\t'))
+			last--;
+		if (first < last && parseNumber(first, last, value) != last)
+			throw std::exception("Invalid CSV field!");
+
+		if (c == labelColumn)
+			*label = value;
+		else
+			*feats++ = value;
+
+		ptr = stop + 1;
+	}
+}
+
+//Writes the pairs of one line with indices starting at 0, returns their count
+int TextReader::parseLibsvmLine(const char * ptr, const char * end,
+	double * values, int * indices, double & label) const
+{
+	auto comment = static_cast<const char *>(std::memchr(ptr, '#', end - ptr));
+	if (comment)
+		end = comment;
+
+	ptr = parseNumber(skipSpaces(ptr, end), end, label);
+
+	int count = 0;
+	while ((ptr = skipSpaces(ptr, end)) < end)
+	{
+		int index = 0;
+		auto rst = std::from_chars(ptr, end, index);
+		if (rst.ec != std::errc() || rst.ptr == end || *rst.ptr != ':' || index < 1 ||
+			(numOfFeatures > 0 && index > numOfFeatures))
+			throw std::exception("Invalid LIBSVM pair!");
+
+		ptr = parseNumber(rst.ptr + 1, end, values[count]);
+		indices[count++] = index - 1;
+	}
+
+	return count;
+}
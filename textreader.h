@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <opencv2\core.hpp>
+
+#include "csrmatrix.h"
+#include "mappedfile.h"
+
+using cv::Mat;
+using std::vector;
+
+//Reader for CSV files and LIBSVM files ("label index:value ..." with indices
+//starting at 1). The file is mapped into memory, split at line boundaries
+//and parsed by all the executor threads straight into the output matrix.
+//nextBatch() streams the file batch by batch instead, reusing the output
+//buffers when the batch shape does not change.
+class TextReader
+{
+public:
+	enum Format { CSV, LIBSVM };
+
+	explicit TextReader(const std::string & path, Format f = CSV);
+	TextReader(const TextReader &) = delete;
+	TextReader & operator= (const TextReader &) = delete;
+
+	void setDelimiter(char d)
+	{
+		delimiter = d;
+	}
+	//Skipping the first line of a CSV file
+	void setHeader(bool h)
+	{
+		header = h;
+		rewind();
+	}
+	//Column of a CSV file holding the labels, -1 means there are none
+	void setLabelColumn(int c)
+	{
+		labelColumn = c;
+	}
+	//Number of features of a LIBSVM file, 0 means the largest index found
+	void setNumOfFeatures(int n)
+	{
+		if (n >= 0)
+			numOfFeatures = n;
+	}
+
+	//Reading the whole file, features is N*D and labels is N*1 (or empty)
+	void read(Mat & features, Mat & labels);
+	CsrMatrix readSparse(Mat & labels);
+
+	//Reading at most n following samples, returns false at the end of file
+	bool nextBatch(int n, Mat & features, Mat & labels);
+	bool nextBatch(int n, CsrMatrix & features, Mat & labels);
+	void rewind();
+
+private:
+	std::shared_ptr<MappedFile> file;
+	Format format;
+	char delimiter = ',';
+	bool header = false;
+	int labelColumn = -1;
+	int numOfFeatures = 0;
+	int numOfColumns = 0;
+	const char * position;
+
+	const char * dataBegin() const;
+	const char * dataEnd() const;
+	vector<const char *> splitLines(const char * begin, const char * end) const;
+	vector<const char *> takeLines(int n);
+	void prepareCsv(const char * begin, const char * end);
+	void prepareLibsvm(const char * begin, const char * end);
+
+	void parseCsvLine(const char * ptr, const char * end,
+		double * feats, double * label) const;
+	int parseLibsvmLine(const char * ptr, const char * end,
+		double * values, int * indices, double & label) const;
+};